@@ -0,0 +1,82 @@
+#include "barseries.h"
+#include <QJsonArray>
+
+static const char *barColumnNames[] = {"open", "high", "low", "close", "volume", "time"};
+static const char *barColumnMethods[] = {"O", "H", "L", "C", "V", "T"};
+
+BarSeries::BarSeries(QString c, QString s, int interval)
+    : cls(c),
+      sec(s),
+      barInterval(interval),
+      objId(-1),
+      ready(false),
+      subCount(0),
+      lastUsedMs(0)
+{
+}
+
+QString BarSeries::makeKey(const QString &cls, const QString &sec, int interval)
+{
+    return QString("%1|%2|%3").arg(cls).arg(sec).arg(interval);
+}
+
+bool BarSeries::isValidInterval(int interval)
+{
+    static const int quikIntervals[] = {0, 1, 2, 3, 4, 5, 6, 10, 15, 20, 30, 60, 120, 240, 1440, 10080, 23200};
+    unsigned int i;
+    for(i=0; i<sizeof(quikIntervals)/sizeof(quikIntervals[0]); i++)
+    {
+        if(quikIntervals[i] == interval)
+            return true;
+    }
+    return false;
+}
+
+const char *BarSeries::columnName(int column)
+{
+    return (column >= 0 && column < ColumnsCount) ? barColumnNames[column] : "";
+}
+
+const char *BarSeries::columnMethod(int column)
+{
+    return (column >= 0 && column < ColumnsCount) ? barColumnMethods[column] : "";
+}
+
+void BarSeries::resize(int n)
+{
+    int c;
+    for(c=0; c<Time; c++)
+        valueCols[c].resize(n);
+    timeCol.resize(n);
+}
+
+void BarSeries::setValue(int column, int index, const QVariant &value)
+{
+    if(index < 1 || column < 0 || column >= ColumnsCount)
+        return;
+    if(index > size())
+        resize(index);
+    if(column == Time)
+        timeCol[index - 1] = value;
+    else
+        valueCols[column][index - 1] = value.toDouble();
+}
+
+QJsonObject BarSeries::columns(int from, int to) const
+{
+    QJsonObject res;
+    int c, i;
+    for(c=0; c<ColumnsCount; c++)
+    {
+        QJsonArray col;
+        for(i=from; i<=to; i++)
+        {
+            if(c == Time)
+                col.append(QJsonValue::fromVariant(timeCol.at(i - 1)));
+            else
+                col.append(valueCols[c].at(i - 1));
+        }
+        res.insert(barColumnNames[c], col);
+    }
+    return res;
+}
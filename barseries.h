@@ -0,0 +1,65 @@
+#ifndef BARSERIES_H
+#define BARSERIES_H
+
+#include <QString>
+#include <QVariant>
+#include <QVector>
+#include <QJsonObject>
+
+//Свечи одного источника данных квика (класс, бумага, интервал) в памяти сервера.
+//Хранятся по столбцам: цены и объём - массивы double, время - таблицы даты/времени квика.
+//Индексы свечей как у DataSource: с 1 до size(). Живёт только в потоке сервера.
+//Источник закрывается, когда от него отписался последний клиент или, если подписок
+//не было, после простоя (см. BridgeTCPServer::closeIdleBarSeries).
+class BarSeries
+{
+public:
+    enum Column
+    {
+        Open,
+        High,
+        Low,
+        Close,
+        Volume,
+        Time,
+        ColumnsCount
+    };
+    BarSeries(QString cls, QString sec, int interval);
+    static QString makeKey(const QString &cls, const QString &sec, int interval);
+    //интервал - одна из констант INTERVAL_* квика (в минутах, 0 - тики)
+    static bool isValidInterval(int interval);
+    static const char *columnName(int column);
+    //метод DataSource, которым читается столбец
+    static const char *columnMethod(int column);
+    QString key() const {return makeKey(cls, sec, barInterval);}
+    QString classCode() const {return cls;}
+    QString securityCode() const {return sec;}
+    int interval() const {return barInterval;}
+    int objectId() const {return objId;}
+    void setObjectId(int id) {objId = id;}
+    int size() const {return timeCol.count();}
+    //история источника грузится асинхронно: готов после первого заполнения свечами
+    bool isReady() const {return ready;}
+    void setReady() {ready = true;}
+    int subscribers() const {return subCount;}
+    void addSubscriber() {subCount++;}
+    int removeSubscriber() {return subCount > 0 ? --subCount : 0;}
+    qint64 lastUsed() const {return lastUsedMs;}
+    void touch(qint64 now) {lastUsedMs = now;}
+    void resize(int n);
+    void setValue(int column, int index, const QVariant &value);
+    //столбцы свечей from..to (включительно, индексы уже проверены вызывающим)
+    QJsonObject columns(int from, int to) const;
+private:
+    QString cls;
+    QString sec;
+    int barInterval;
+    int objId;
+    bool ready;
+    int subCount;
+    qint64 lastUsedMs;
+    QVector<double> valueCols[Time];
+    QVector<QVariant> timeCol;
+};
+
+#endif // BARSERIES_H
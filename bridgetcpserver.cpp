@@ -1,36 +1,264 @@
 #include "bridgetcpserver.h"
 #include <QRegularExpression>
+#include <algorithm>
 
 #define ALLOW_LOCAL_IP
 
 BridgeTCPServer * BridgeTCPServer::g_server = nullptr;
+#define BARS_UPDATE_DEFAULT_INTERVAL_MS  100
+#define INVOKE_RANGE_DEFAULT_MAX    10000
+//номера подписчиков фильтров колбеков, не являющихся соединениями; соединения нумеруются после них
+#define JOURNAL_SUBSCRIBER_ID   1
+#define MIRROR_SUBSCRIBER_ID    2
+//источник без подписчиков закрывается после стольких мс без запросов getBars
+#define BARS_IDLE_CLOSE_MS  60000
+//столько мс getBars ждёт загрузки истории только что созданного источника
+#define BARS_READY_TIMEOUT_MS   5000
+
 struct FastCallbackFunctionData
 {
     ConnectionData *cd;
     int objId;
     QString funName;
-    FastCallbackFunctionData():cd(nullptr),objId(-1){}
-    FastCallbackFunctionData(QString fn):cd(nullptr),objId(-1),funName(fn){}
+    //режим coalesced: вместо вызова клиента на каждый индекс копим диапазон
+    //и раз в intervalMs отправляем barsUpdate с готовыми значениями свечей
+    bool coalesced;
+    int intervalMs;
+    int reqId;
+    QString seriesKey;  //колбек общего источника данных: диапазон читает сам сервер
+    FastCallbackFunctionData():cd(nullptr),objId(-1),coalesced(false),intervalMs(0),reqId(-1){}
+    FastCallbackFunctionData(QString fn):cd(nullptr),objId(-1),funName(fn),coalesced(false),intervalMs(0),reqId(-1){}
 };
 
+#define PARAM_WHEEL_SLOTS   512
+#define PARAM_WHEEL_TICK_MS 10
+
+static QByteArray jsonBody(const QJsonObject &obj)
+{
+    return QJsonDocument(obj).toJson(QJsonDocument::Compact);
+}
+
+//Метки этапов доставки (monotonicNs): cb - вход в колбек квика, lua - конец разбора
+//или чтения данных из луа, dq - выборка события потоком сервера. Неизвестные (0) не пишутся.
+static QJsonObject stageStamps(qint64 cbNs, qint64 dqNs, qint64 luaNs)
+{
+    QJsonObject ts;
+    if(cbNs)
+        ts.insert("cb", cbNs);
+    if(dqNs)
+        ts.insert("dq", dqNs);
+    if(luaNs)
+        ts.insert("lua", luaNs);
+    return ts;
+}
+
+const QByteArray &NotificationBody::bytes(bool withTs)
+{
+    if(!withTs || ts.isEmpty())
+        return plain;
+    if(stamped.isEmpty())
+    {
+        //тело - JSON-объект, метки дописываются последним ключом
+        stamped = plain;
+        stamped.chop(1);
+        stamped.append(",\"ts\":");
+        stamped.append(jsonBody(ts));
+        stamped.append('}');
+    }
+    return stamped;
+}
+
+static bool isBulkParamRequest(const QJsonObject &jobj)
+{
+    return jobj.contains("securities") || jobj.contains("params") || jobj.value("security").toString() == "*";
+}
+
+static QStringList jsonStringList(const QJsonObject &jobj, QString listKey, QString itemKey)
+{
+    QStringList res;
+    if(jobj.contains(listKey))
+    {
+        QJsonArray jarr = jobj.value(listKey).toArray();
+        int i;
+        for(i=0; i<jarr.count(); i++)
+        {
+            QString item = jarr.at(i).toString();
+            if(!item.isEmpty() && !res.contains(item))
+                res.append(item);
+        }
+    }
+    else if(jobj.contains(itemKey))
+        res.append(jobj.value(itemKey).toString());
+    return res;
+}
+
+#define ROWS_STREAM_DEFAULT_CHUNK   500
+#define PARAMS_SNAPSHOT_CHUNK       100
+
+//Добавляет в table прошедшие фильтр строки, начиная с pos, пока не наберёт limit (0 - до конца).
+//Возвращает true, если проход не закончен
+bool RowsQuery::next(int limit, QJsonArray &table)
+{
+    int n = count();
+    int taken = 0;
+    while(pos < n && (limit <= 0 || taken < limit))
+    {
+        int rowId = indexed ? candidates.at(pos) : pos;
+        pos++;
+        //строка зеркала могла быть удалена, пока потоковая выдача ждала своей очереди
+        if(mirror && !mirror->isLive(rowId))
+            continue;
+        const QVariantMap &row = mirror ? mirror->row(rowId) : rows.at(rowId);
+        if(!flt.match(row))
+            continue;
+        if(fields.isEmpty())
+            table.append(QJsonObject::fromVariantMap(row));
+        else
+        {
+            QJsonObject prj;
+            foreach (QString fname, fields)
+            {
+                QVariantMap::const_iterator it = row.constFind(fname);
+                if(it != row.constEnd())
+                    prj.insert(fname, QJsonValue::fromVariant(it.value()));
+            }
+            table.append(prj);
+        }
+        taken++;
+    }
+    return pos < n;
+}
+
+static void applyParamConsumerOptions(ParamConsumer *pc, const QJsonObject &jobj)
+{
+    int minIntervalMs = jobj.value("minIntervalMs").toInt(0);
+    if(jobj.contains("maxRate"))
+    {
+        double maxRate = jobj.value("maxRate").toDouble(0);
+        if(maxRate > 0)
+            minIntervalMs = qMax(minIntervalMs, (int)(1000.0 / maxRate));
+    }
+    pc->minIntervalMs = qMax(0, minIntervalMs);
+    pc->deadband = qMax(0.0, jobj.value("deadband").toDouble(0));
+    pc->deadbandRel = qMax(0.0, jobj.value("deadbandRel").toDouble(0));
+    pc->grouped = jobj.value("grouped").toBool(false);
+}
+
+static QJsonObject quotesChangeMessage(QString cls, QString sec, const QVariantMap &quotes)
+{
+    QJsonObject msg
+    {
+        {"method", "quotesChange"},
+        {"class", cls},
+        {"security", sec},
+        {"quotes", QJsonValue::fromVariant(quotes)}
+    };
+    return msg;
+}
+
+static QJsonObject quotesChangeMessage(QString cls, QString sec, const QuoteBook &book, int scale)
+{
+    QJsonObject quotes = book.snapshot(true);
+    quotes.insert("scale", scale);
+    QJsonObject msg
+    {
+        {"method", "quotesChange"},
+        {"class", cls},
+        {"security", sec},
+        {"quotes", quotes}
+    };
+    return msg;
+}
+
+static QJsonObject quotesSnapshotMessage(QString cls, QString sec, const QuoteBook &book, bool numeric, int scale)
+{
+    QJsonObject msg = book.snapshot(numeric);
+    if(numeric)
+        msg.insert("scale", scale);
+    msg.insert("method", "quotesSnapshot");
+    msg.insert("class", cls);
+    msg.insert("security", sec);
+    return msg;
+}
+
+static QJsonObject quotesDeltaMessage(QString cls, QString sec, const QJsonObject &bookDiff)
+{
+    QJsonObject msg = bookDiff;
+    msg.insert("method", "quotesDelta");
+    msg.insert("class", cls);
+    msg.insert("security", sec);
+    return msg;
+}
+
+static QVariantMap trimLevel2(const QVariantMap &level2, int depth)
+{
+    //лучшие покупки в конце bid, лучшие продажи в начале offer
+    QVariantMap res = level2;
+    QVariantList bids = level2.value("bid").toList();
+    if(bids.count() > depth)
+        bids = bids.mid(bids.count() - depth);
+    QVariantList offers = level2.value("offer").toList();
+    if(offers.count() > depth)
+        offers = offers.mid(0, depth);
+    if(res.contains("bid"))
+        res.insert("bid", bids);
+    if(res.contains("offer"))
+        res.insert("offer", offers);
+    res.insert("bid_count", QString::number(bids.count(), 'f', 6));
+    res.insert("offer_count", QString::number(offers.count(), 'f', 6));
+    return res;
+}
+
+static QJsonObject paramChangeMessage(QString cls, QString sec, QString param, const QVariant &value)
+{
+    QJsonObject msg
+    {
+        {"method", "paramChange"},
+        {"class", cls},
+        {"security", sec},
+        {"param", param},
+        {"value", QJsonValue::fromVariant(value)}
+    };
+    return msg;
+}
+
 BridgeTCPServer::BridgeTCPServer(QObject *parent)
-    : QTcpServer(parent), logf(nullptr), logts(nullptr)
+    : QTcpServer(parent), lastConnectionId(MIRROR_SUBSCRIBER_ID), journalSpillTimer(nullptr), logf(nullptr), logts(nullptr), refSnapshotSavePending(false),
+      invokeRangeMax(INVOKE_RANGE_DEFAULT_MAX), barsIdleTimer(nullptr), paramWheel(PARAM_WHEEL_SLOTS, PARAM_WHEEL_TICK_MS), paramWheelTimer(nullptr)
 {
     g_server = this;
     connect(this, SIGNAL(acceptError(QAbstractSocket::SocketError)), this, SLOT(serverError(QAbstractSocket::SocketError)));
+    updateSecurityInterest();
+    qqBridge->setSecurityInterest(&securityInterest);
     qqBridge->registerCallback(this, "OnStop");
     activeCallbacks.append("OnStop");
     qqBridge->registerCallback(this, "OnParam");
     activeCallbacks.append("OnParam");
     qqBridge->registerCallback(this, "OnQuote");
     activeCallbacks.append("OnQuote");
+    //по ним сбрасывается кеш справочных данных
+    qqBridge->registerCallback(this, "OnConnected");
+    activeCallbacks.append("OnConnected");
+    qqBridge->registerCallback(this, "OnCleanUp");
+    activeCallbacks.append("OnCleanUp");
 }
 
 BridgeTCPServer::~BridgeTCPServer()
 {
+    qqBridge->setSecurityInterest(nullptr);
+    if(refSnapshot.isDirty())
+        refSnapshot.save();
+    qDeleteAll(rowStreams);
+    rowStreams.clear();
+    qDeleteAll(mirrors);
+    mirrors.clear();
+    while(!barSeries.isEmpty())
+        closeBarSeries(barSeries.first());
     while(!m_connections.isEmpty())
     {
+        connectionsMutex.lock();
         ConnectionData *cd = m_connections.takeLast();
+        connectionsMutex.unlock();
         paramSubscriptions.clearAllSubscriptions(cd);
         delete cd;
     }
@@ -62,73 +290,199 @@ void BridgeTCPServer::setDebugLogPathPrefix(QString lpp)
     }
 }
 
-void BridgeTCPServer::callbackRequest(QString name, const QVariantList &args, QVariant &vres)
+void BridgeTCPServer::setJournalConfig(const QStringList &cbNames, int ringSize, QString spillPath, qint64 spillMaxSize)
+{
+    if(cbNames.isEmpty() || ringSize <= 0)
+        return;
+    journal.configure(cbNames, ringSize, spillPath, spillMaxSize);
+    foreach (QString name, cbNames)
+    {
+        if(!activeCallbacks.contains(name))
+        {
+            qqBridge->registerCallback(this, name);
+            activeCallbacks.append(name);
+        }
+        updateCallbackFilters(name);
+    }
+    updateSecurityInterest();
+    if(!spillPath.isEmpty() && !journalSpillTimer)
+    {
+        journalSpillTimer = new QTimer(this);
+        connect(journalSpillTimer, SIGNAL(timeout()), this, SLOT(flushJournal()));
+        journalSpillTimer->start(1000);
+    }
+    sendStdoutLine(QString("Callback journal enabled for %1, ring size %2").arg(cbNames.join(",")).arg(ringSize));
+}
+
+void BridgeTCPServer::setReferenceDataConfig(int ttlSec, const QStringList &preloadClasses, QString snapshotPath)
+{
+    refData.setTtl(ttlSec);
+    if(!snapshotPath.isEmpty())
+    {
+        if(refSnapshot.open(snapshotPath))
+        {
+            sendStdoutLine(QString("Reference data snapshot loaded: %1 classes, securities of %2 classes")
+                           .arg(refSnapshot.classes().count()).arg(refSnapshot.classesCount()));
+            if(!refSnapshot.classes().isEmpty())
+                refData.setClasses(refSnapshot.classes());
+        }
+        else
+            sendStdoutLine(QString("Reference data snapshot %1 is missing or outdated, it will be rebuilt").arg(snapshotPath));
+        //пустая строка в очереди - сверка списка классов
+        refSnapshotCheckQueue.append(QString());
+        refSnapshotCheckQueue.append(refSnapshot.storedClasses());
+        QTimer::singleShot(1000, this, SLOT(verifyReferenceSnapshot()));
+    }
+    refDataPreload = preloadClasses;
+    if(!refDataPreload.isEmpty())
+    {
+        refDataPreloadQueue = refDataPreload;
+        //даём терминалу закончить запуск скрипта, прежде чем ходить в луа
+        QTimer::singleShot(1000, this, SLOT(preloadReferenceData()));
+    }
+}
+
+void BridgeTCPServer::callbackRequest(QString name, const QVariantList &args, QVariant &vres, const CallbackDispatch *dispatch)
 {
     if(!activeCallbacks.contains(name))
     {
         sendStderrLine(QString("Called callback %1 was not registered").arg(name));
         return;
     }
-    QJsonObject cbCall
+    //журналируемое событие нумеруется под мьютексом журнала, а список получателей снимается под
+    //connectionsMutex, взятым до освобождения журнала: новая подписка с fromSeq (register берёт оба
+    //в том же порядке) либо получит событие повтором, либо попадёт в этот список, но не то и другое.
+    //Журнал отпускается сразу, чтобы рассылка не задерживала flushSpill и повтор в потоке сервера
+    bool journaled = journal.isJournaled(name);
+    qint64 seq = 0;
+    if(journaled)
     {
-        {"method", "callback"},
-        {"name", name},
-        {"arguments", QJsonArray::fromVariantList(args)}
-    };
+        journal.mutex.lock();
+        seq = journal.append(name, args);
+        connectionsMutex.lock();
+        journal.mutex.unlock();
+    }
+    else
+        connectionsMutex.lock();
+    //из потока квика отправка только ставится в очередь потока соединения, в сокет здесь не пишем
+    QJsonObject cbCall, cbCallTs;
+    QJsonObject stamps;
+    if(dispatch)
+        stamps = stageStamps(dispatch->entryNs, 0, dispatch->parsedNs);
     ConnectionData *cd;
     foreach (cd, m_connections)
     {
         if(cd->callbackSubscriptions.contains(name))
         {
+            CallbackFilter flt = cd->callbackFilters.value(name);
+            if(dispatch && dispatch->filtered)
+            {
+                if(!dispatch->subscribers.contains(cd->connId))
+                    continue;
+            }
+            else if(!flt.matchArguments(args))
+                continue;
             int id = cd->callbackSubscriptions.value(name);
-            // qDebug() << "Сall safeSendReq from BridgeTCPServer::callbackRequest";
-            safeSendReq(cd, id, cbCall, false);
+            if(flt.projection().isEmpty())
+            {
+                if(cbCall.isEmpty())
+                    cbCall = callbackMessage(name, seq, args);
+                if(cd->timestamps && !stamps.isEmpty())
+                {
+                    if(cbCallTs.isEmpty())
+                    {
+                        cbCallTs = cbCall;
+                        cbCallTs.insert("ts", stamps);
+                    }
+                    safeSendReq(cd, id, cbCallTs, false);
+                }
+                else
+                    safeSendReq(cd, id, cbCall, false);
+            }
+            else
+            {
+                QJsonObject prjCall = callbackMessage(name, seq, flt.projectArguments(args));
+                if(cd->timestamps && !stamps.isEmpty())
+                    prjCall.insert("ts", stamps);
+                safeSendReq(cd, id, prjCall, false);
+            }
         }
     }
+    connectionsMutex.unlock();
     if(name == "OnStop")
     {
         qApp->quit();
         vres = (int)100;
     }
-    if(name == "OnParam")
+    if(name == "OnConnected" || name == "OnCleanUp")
+        QMetaObject::invokeMethod(this, "invalidateReferenceData", Qt::QueuedConnection);
+    //строки таблиц торговли уходят в зеркала в потоке сервера; колбеки таблиц без зеркала
+    //(на них может быть подписан клиент) в очередь не ставим
+    const TableMirrorSpec *mirrorSpec = TableMirror::findSpecByCallback(name);
+    if(mirrorSpec && (mirroredTables.loadAcquire() & (1u << TableMirror::specIndex(mirrorSpec))))
     {
-        QString cls = args[0].toString();
-        QString sec = args[1].toString();
-        QMetaObject::invokeMethod(this, "secParamsUpdate", Qt::QueuedConnection,
-                                  Q_ARG(QString, cls),
-                                  Q_ARG(QString, sec));
-        /*
-        SecSubs *s = paramSubscriptions.findSecuritySubscriptions(cls, sec);
-        if(s)
-        {
-            QMetaObject::invokeMethod(this, "secParamsUpdate", Qt::QueuedConnection,
-                                      Q_ARG(QString, cls),
-                                      Q_ARG(QString, sec));
+        int i;
+        for(i=0; i<args.count(); i++)
+        {
+            if(args.at(i).type() == QVariant::Map)
+            {
+                QMetaObject::invokeMethod(this, "applyMirrorUpdate", Qt::QueuedConnection, Q_ARG(QString, name), Q_ARG(QVariantMap, args.at(i).toMap()));
+                break;
+            }
         }
-        */
+    }
+    //OnParam/OnQuote не передаём в поток сервера по одному: бумага помечается в updateQueue,
+    //а поток сервера будится один раз и обрабатывает каждую помеченную бумагу один раз за проход
+    qint64 entryNs = dispatch ? dispatch->entryNs : 0;
+    if(name == "OnParam")
+    {
+        if(updateQueue.markDirty(args[0].toString(), args[1].toString(), SecurityUpdateQueue::ParamsUpdate, entryNs))
+            QMetaObject::invokeMethod(this, "processSecurityUpdates", Qt::QueuedConnection);
     }
     if(name == "OnQuote")
     {
-        QString cls = args[0].toString();
-        QString sec = args[1].toString();
-        QMetaObject::invokeMethod(this, "secQuotesUpdate", Qt::QueuedConnection,
-                                  Q_ARG(QString, cls),
-                                  Q_ARG(QString, sec));
-        /*
-        SecSubs *s = paramSubscriptions.findSecuritySubscriptions(cls, sec);
-        if(s)
-        {
-            QMetaObject::invokeMethod(this, "secQuotesUpdate", Qt::QueuedConnection,
-                                      Q_ARG(QString, cls),
-                                      Q_ARG(QString, sec));
-        }
-        */
+        if(updateQueue.markDirty(args[0].toString(), args[1].toString(), SecurityUpdateQueue::QuotesUpdate, entryNs))
+            QMetaObject::invokeMethod(this, "processSecurityUpdates", Qt::QueuedConnection);
     }
 }
 
 void BridgeTCPServer::fastCallbackRequest(void *data, const QVariantList &args, QVariant &res)
 {
     FastCallbackFunctionData *fcfdata = reinterpret_cast<FastCallbackFunctionData *>(data);
+    if(fcfdata->coalesced)
+    {
+        int idx = args.isEmpty() ? -1 : args.at(0).toInt();
+        if(idx < 0)
+            return;
+        bool schedule = false;
+        barsMutex.lock();
+        QMap<void *, PendingBarsUpdate>::iterator it = pendingBars.find(data);
+        if(it == pendingBars.end())
+        {
+            PendingBarsUpdate pbu;
+            pbu.cd = fcfdata->cd;
+            pbu.objId = fcfdata->objId;
+            pbu.reqId = fcfdata->reqId;
+            pbu.funName = fcfdata->funName;
+            pbu.from = idx;
+            pbu.to = idx;
+            pbu.due = QDateTime::currentMSecsSinceEpoch() + fcfdata->intervalMs;
+            pbu.seriesKey = fcfdata->seriesKey;
+            pendingBars.insert(data, pbu);
+            schedule = true;
+        }
+        else
+        {
+            if(idx < it.value().from)
+                it.value().from = idx;
+            if(idx > it.value().to)
+                it.value().to = idx;
+        }
+        barsMutex.unlock();
+        if(schedule)
+            QMetaObject::invokeMethod(this, "scheduleBarsUpdate", Qt::QueuedConnection, Q_ARG(int, fcfdata->intervalMs));
+        return;
+    }
     if(fcfdata->cd)
     {
         if(m_connections.contains(fcfdata->cd))
@@ -143,7 +497,12 @@ void BridgeTCPServer::clearFastCallbackData(void *data)
 {
     FastCallbackFunctionData *fcfdata = reinterpret_cast<FastCallbackFunctionData *>(data);
     if(fcfdata)
+    {
+        barsMutex.lock();
+        pendingBars.remove(data);
+        barsMutex.unlock();
         delete fcfdata;
+    }
 }
 
 void BridgeTCPServer::sendStdoutLine(QString line)
@@ -170,6 +529,113 @@ void BridgeTCPServer::sendStderrLine(QString line)
     }
 }
 
+QJsonObject BridgeTCPServer::callbackMessage(QString name, qint64 seq, const QVariantList &args)
+{
+    QJsonObject cbCall
+    {
+        {"method", "callback"},
+        {"name", name},
+        {"arguments", QJsonArray::fromVariantList(args)}
+    };
+    if(seq > 0)
+        cbCall.insert("seq", seq);
+    return cbCall;
+}
+
+bool BridgeTCPServer::isInternalCallback(QString name)
+{
+    //эти колбеки сервер обрабатывает сам, поэтому на стороне луа их не фильтруем
+    return (name=="OnStop" || name=="OnParam" || name=="OnQuote" || name=="OnConnected" || name=="OnCleanUp");
+}
+
+void BridgeTCPServer::updateCallbackFilters(QString name)
+{
+    if(isInternalCallback(name))
+        return;
+    CallbackFilterList flist;
+    if(journal.isJournaled(name))
+        flist.append(CallbackFilterEntry(JOURNAL_SUBSCRIBER_ID, CallbackFilter()));
+    //зеркалу нужны все строки целиком, фильтры и проекции клиентов не должны их отсекать
+    foreach (TableMirror *m, mirrors)
+    {
+        if(m->callback() == name || m->deleteCallback() == name)
+            flist.append(CallbackFilterEntry(MIRROR_SUBSCRIBER_ID, CallbackFilter()));
+    }
+    ConnectionData *cd;
+    foreach (cd, m_connections)
+    {
+        if(cd->callbackSubscriptions.contains(name))
+            flist.append(CallbackFilterEntry(cd->connId, cd->callbackFilters.value(name)));
+    }
+    qqBridge->setCallbackFilters(name, flist);
+}
+
+void BridgeTCPServer::removeConnection(ConnectionData *cd)
+{
+    connectionsMutex.lock();
+    m_connections.removeAll(cd);
+    connectionsMutex.unlock();
+    paramSubscriptions.clearAllSubscriptions(cd);
+    //незаконченные потоковые выдачи этому клиенту больше не нужны
+    int i;
+    for(i=rowStreams.count()-1; i>=0; i--)
+    {
+        if(rowStreams.at(i)->cd == cd)
+            delete rowStreams.takeAt(i);
+    }
+    for(i=paramSnapshots.count()-1; i>=0; i--)
+    {
+        if(paramSnapshots.at(i).cd == cd)
+            paramSnapshots.removeAt(i);
+    }
+    for(i=mirrorSubscriptions.count()-1; i>=0; i--)
+    {
+        if(mirrorSubscriptions.at(i).cd == cd)
+            mirrorSubscriptions.removeAt(i);
+    }
+    for(i=pendingBarsRequests.count()-1; i>=0; i--)
+    {
+        if(pendingBarsRequests.at(i).cd == cd)
+            pendingBarsRequests.removeAt(i);
+    }
+    QStringList barKeys;
+    for(i=barsSubscriptions.count()-1; i>=0; i--)
+    {
+        if(barsSubscriptions.at(i).cd == cd)
+        {
+            BarSeries *s = barSeries.value(barsSubscriptions.at(i).key, nullptr);
+            if(s && s->removeSubscriber() == 0)
+                barKeys.append(s->key());
+            barsSubscriptions.removeAt(i);
+        }
+    }
+    foreach (QString key, barKeys)
+        releaseBarSeries(key);
+    QStringList cbNames = cd->callbackSubscriptions.keys();
+    foreach (QString name, cbNames)
+        updateCallbackFilters(name);
+    updateSecurityInterest();
+    delete cd;
+}
+
+void BridgeTCPServer::updateSecurityInterest()
+{
+    QList<SecurityKey> paramSecs, quoteSecs;
+    paramSubscriptions.collectSecurities(paramSecs, quoteSecs);
+    //если кто-то подписан на сами колбеки OnParam/OnQuote, отсекать по бумагам нельзя
+    bool allParams = journal.isJournaled("OnParam");
+    bool allQuotes = journal.isJournaled("OnQuote");
+    ConnectionData *cd;
+    foreach (cd, m_connections)
+    {
+        if(cd->callbackSubscriptions.contains("OnParam"))
+            allParams = true;
+        if(cd->callbackSubscriptions.contains("OnQuote"))
+            allQuotes = true;
+    }
+    securityInterest.publish(paramSecs, quoteSecs, allParams, allQuotes);
+}
+
 bool BridgeTCPServer::ipAllowed(QString ip)
 {
     sendStdoutLine(QString("Checking ip: ") + ip);
@@ -188,14 +654,160 @@ bool BridgeTCPServer::ipAllowed(QString ip)
     return false;
 }
 
-void BridgeTCPServer::cacheSecClasses()
+QStringList BridgeTCPServer::secClasses()
 {
-    if(secClasses.isEmpty())
+    QStringList classes;
+    if(!refData.classes(classes))
     {
         QVariantList args, res;
         qqBridge->invokeMethod("getClassesList", args, res, this);
-        secClasses = res[0].toString().split(",", Qt::SkipEmptyParts);
+        classes = res[0].toString().split(",", Qt::SkipEmptyParts);
+        refData.setClasses(classes);
+        if(refSnapshot.isEnabled())
+        {
+            refSnapshot.setClasses(classes, ReferenceDataSnapshot::listHash(res[0].toString()));
+            scheduleReferenceSnapshotSave();
+        }
+    }
+    return classes;
+}
+
+bool BridgeTCPServer::loadClassSecurities(QString cls, QList<QVariantMap> &rows, quint64 *version)
+{
+    if(refData.classSecurities(cls, rows, version))
+        return true;
+    //класс из снимка, ещё не сверенный с терминалом, отдаётся сразу: сверка идёт в фоне
+    bool loaded = refSnapshot.isTrusted(cls) && refSnapshot.classSecurities(cls, QByteArray(), rows);
+    if(!loaded)
+    {
+        QVariantList args, res;
+        args << cls;
+        qqBridge->invokeMethod("getClassSecurities", args, res, this);
+        QString secList = res[0].toString();
+        refData.setClassSecurityCodes(cls, secList.split(",", Qt::SkipEmptyParts));
+        QByteArray hash = ReferenceDataSnapshot::listHash(secList);
+        //список бумаг не изменился - строки берутся из снимка без getSecurityInfo
+        if(!refSnapshot.isEnabled() || !refSnapshot.classSecurities(cls, hash, rows))
+        {
+            QStringList allSecs = secList.split(",", Qt::SkipEmptyParts);
+            //getSecurityInfo по всем бумагам класса - один проход в луа
+            QList<QVariantList> argsList;
+            int i;
+            for(i=0; i<allSecs.count(); i++)
+                argsList.append(QVariantList() << cls << allSecs.at(i));
+            QVariantList infos;
+            if(!qqBridge->invokeMethodBatch("getSecurityInfo", argsList, infos, this))
+                return false;
+            rows.clear();
+            for(i=0; i<infos.count(); i++)
+                rows.append(infos.at(i).toMap());
+            if(refSnapshot.isEnabled())
+            {
+                refSnapshot.setClassSecurities(cls, hash, rows);
+                scheduleReferenceSnapshotSave();
+            }
+        }
+    }
+    quint64 ver = refData.setClassSecurities(cls, rows);
+    if(version)
+        *version = ver;
+    return true;
+}
+
+//Коды бумаг класса: из кеша (в том числе из загруженных строк класса), иначе getClassSecurities
+QStringList BridgeTCPServer::classSecurityCodes(QString cls)
+{
+    QStringList codes;
+    if(refData.classSecurityCodes(cls, codes))
+        return codes;
+    QVariantList args, res;
+    args << cls;
+    qqBridge->invokeMethod("getClassSecurities", args, res, this);
+    if(res.isEmpty())
+        return codes;
+    codes = res[0].toString().split(",", Qt::SkipEmptyParts);
+    refData.setClassSecurityCodes(cls, codes);
+    return codes;
+}
+
+bool BridgeTCPServer::loadAccounts(QList<QVariantMap> &rows, quint64 *version)
+{
+    if(refData.accounts(rows, version))
+        return true;
+    QVariantList args, res;
+    args << "trade_accounts";
+    qqBridge->invokeMethod("getNumberOf", args, res, this);
+    int i, n = res[0].toInt();
+    QList<QVariantList> argsList;
+    for(i=0; i<n; i++)
+        argsList.append(QVariantList() << "trade_accounts" << i);
+    QVariantList items;
+    if(!qqBridge->invokeMethodBatch("getItem", argsList, items, this))
+        return false;
+    rows.clear();
+    for(i=0; i<items.count(); i++)
+        rows.append(items.at(i).toMap());
+    quint64 ver = refData.setAccounts(rows);
+    if(version)
+        *version = ver;
+    return true;
+}
+
+void BridgeTCPServer::answerRowsQuery(RowsQuery *q, QJsonObject &jobj)
+{
+    //курсор - версия строк в кеше и позиция прохода; после перечитывания кеша он недействителен.
+    //У зеркала вместо позиции - номер следующей строки: выборка кандидатов между
+    //страницами меняется, а номера строк до перезаполнения зеркала постоянны
+    if(jobj.contains("cursor"))
+    {
+        QStringList parts = jobj.value("cursor").toString().split(':');
+        bool vok = false, pok = false;
+        quint64 ver = 0;
+        int pos = 0;
+        if(parts.count() == 2)
+        {
+            ver = parts.at(0).toULongLong(&vok);
+            pos = parts.at(1).toInt(&pok);
+        }
+        int maxPos = q->mirror ? q->mirror->slotsCount() : q->count();
+        if(!vok || !pok || ver != q->version || pos < 0 || pos > maxPos)
+        {
+            sendError(q->cd, q->id, 30, "Cursor is invalid or expired, restart the query", true);
+            delete q;
+            return;
+        }
+        if(q->mirror)
+            q->pos = (int)(std::lower_bound(q->candidates.begin(), q->candidates.end(), pos) - q->candidates.begin());
+        else
+            q->pos = pos;
+    }
+    if(jobj.contains("stream"))
+    {
+        q->chunk = jobj.value("stream").toInt(ROWS_STREAM_DEFAULT_CHUNK);
+        if(q->chunk <= 0)
+            q->chunk = ROWS_STREAM_DEFAULT_CHUNK;
+        bool idle = rowStreams.isEmpty();
+        rowStreams.append(q);
+        if(idle)
+            QTimer::singleShot(0, this, SLOT(continueRowStreams()));
+        return;
+    }
+    int limit = jobj.value("limit").toInt(0);
+    QJsonArray table;
+    bool more = q->next(limit, table);
+    QJsonObject invRes
+    {
+        {"method", "return"},
+        {"result", table}
+    };
+    if(limit > 0 || jobj.contains("cursor"))
+    {
+        invRes.insert("more", more);
+        if(more)
+            invRes.insert("cursor", QString("%1:%2").arg(q->version).arg(q->mirror ? q->candidates.at(q->pos) : q->pos));
     }
+    q->cd->proto->sendAns(q->id, invRes, false);
+    delete q;
 }
 
 void BridgeTCPServer::safeSendReq(ConnectionData *cd, int id, QJsonValue data, bool showInLog)
@@ -291,70 +903,60 @@ void BridgeTCPServer::processExtendedRequests(ConnectionData *cd, int id, QStrin
         processSubscribeQuotesRequest(cd, id, jobj);
     else if(method == "unsubscribequotes")
         processUnsubscribeQuotesRequest(cd, id, jobj);
+    else if(method == "requestquotessnapshot")
+        processRequestQuotesSnapshotRequest(cd, id, jobj);
+    else if(method == "getstatistics")
+        processGetStatisticsRequest(cd, id, jobj);
+    else if(method == "enabletimestamps")
+        processEnableTimestampsRequest(cd, id, jobj);
+    else if(method == "querytable")
+        processQueryTableRequest(cd, id, jobj);
+    else if(method == "querymirror")
+        processQueryMirrorRequest(cd, id, jobj);
+    else if(method == "subscribemirror")
+        processSubscribeMirrorRequest(cd, id, jobj);
+    else if(method == "unsubscribemirror")
+        processUnsubscribeMirrorRequest(cd, id, jobj);
+    else if(method == "invokerange")
+        processInvokeRangeRequest(cd, id, jobj);
+    else if(method == "getbars")
+        processGetBarsRequest(cd, id, jobj);
+    else if(method == "subscribebars")
+        processSubscribeBarsRequest(cd, id, jobj);
+    else if(method == "unsubscribebars")
+        processUnsubscribeBarsRequest(cd, id, jobj);
 }
 
 void BridgeTCPServer::processLoadAccountsRequest(ConnectionData *cd, int id, QJsonObject &jobj)
 {
     sendStdoutLine(QString("BridgeTCPServer::processLoadAccountsRequest(%1)").arg(id));
-    QJsonArray filters = jobj.value("filters").toArray();
-    int j, fcnt = filters.count();
-    QVariantList args, res;
-    QVariantMap vmrow;
-    QJsonObject row;
-    QJsonArray table;
-    args << "trade_accounts";
-    qqBridge->invokeMethod("getNumberOf", args, res, this);
-    int i, n = res[0].toInt();
-    bool get;
-    args << 0;
-    for(i=0;i<n;i++)
-    {
-        args[1] = i;
-        qqBridge->invokeMethod("getItem", args, res, this);
-        vmrow = res[0].toMap();
-        get = true;
-        for(j = 0; j < fcnt; j++)
-        {
-            QJsonObject flt = filters.at(j).toObject();
-            if(!flt.contains("key"))
-                continue;
-            QString key = flt.value("key").toString();
-            if(!vmrow.contains(key))
-            {
-                get = false;
-                break;
-            }
-            if(flt.contains("regexp"))
-            {
-                QRegularExpression rexp(flt.value("regexp").toString());
-                QRegularExpressionMatch match = rexp.match(vmrow.value(key).toString());
-                if(!match.hasMatch())
-                {
-                    get = false;
-                    break;
-                }
-            }
-        }
-        if(get)
-        {
-            row = QJsonObject::fromVariantMap(vmrow);
-            table.append(row);
-        }
+    RowsQuery *q = new RowsQuery();
+    q->cd = cd;
+    q->id = id;
+    QString errMsg;
+    if(!q->flt.parse(jobj.value("filters"), errMsg))
+    {
+        sendError(cd, id, 29, errMsg, true);
+        delete q;
+        return;
     }
-    QJsonObject invRes
+    if(!loadAccounts(q->rows, &q->version))
     {
-        {"method", "return"},
-        {"result", table}
-    };
-    cd->proto->sendAns(id, invRes, false);
+        sendError(cd, id, 27, "Failed to load trade accounts", true);
+        delete q;
+        return;
+    }
+    QString ikey;
+    QStringList ivalues;
+    q->indexed = q->flt.indexableKey(ikey, ivalues) && refData.lookupAccounts(ikey, ivalues, q->candidates);
+    answerRowsQuery(q, jobj);
 }
 
 void BridgeTCPServer::processLoadClassesRequest(ConnectionData *cd, int id, QJsonObject &jobj)
 {
     sendStdoutLine(QString("BridgeTCPServer::processLoadClassesRequest(%1)").arg(id));
     QJsonArray clist;
-    cacheSecClasses();
-    clist = QJsonArray::fromStringList(secClasses);
+    clist = QJsonArray::fromStringList(secClasses());
     QJsonObject invRes
     {
         {"method", "return"},
@@ -372,66 +974,508 @@ void BridgeTCPServer::processLoadClassSecuritiesRequest(ConnectionData *cd, int
     }
     sendStdoutLine(QString("BridgeTCPServer::processLoadClassSecuritiesRequest(%1)").arg(id));
     QString cls = jobj.value("class").toString();
-    cacheSecClasses();
-    if(!secClasses.contains(cls, Qt::CaseInsensitive))
+    if(!secClasses().contains(cls, Qt::CaseInsensitive))
     {
         sendError(cd, id, 7, QString("Unknown securities class %1").arg(cls), true);
         return;
     }
-    QJsonArray filters = jobj.value("filters").toArray();
-    int j, fcnt = filters.count();
-    QVariantList args, res;
-    QVariantMap vmrow;
-    QJsonObject row;
-    QJsonArray table;
-    args << cls;
-    qqBridge->invokeMethod("getClassSecurities", args, res, this);
-    QStringList allSecs = res[0].toString().split(",", Qt::SkipEmptyParts);
-    int i, n = allSecs.count();
-    bool get;
-    args << QString();
-    for(i=0;i<n;i++)
+    RowsQuery *q = new RowsQuery();
+    q->cd = cd;
+    q->id = id;
+    QString errMsg;
+    if(!q->flt.parse(jobj.value("filters"), errMsg))
     {
-        args[1] = allSecs[i];
-        qqBridge->invokeMethod("getSecurityInfo", args, res, this);
-        vmrow = res[0].toMap();
-        get = true;
-        for(j = 0; j < fcnt; j++)
-        {
-            QJsonObject flt = filters.at(j).toObject();
-            if(!flt.contains("key"))
-                continue;
-            QString key = flt.value("key").toString();
-            if(!vmrow.contains(key))
-            {
-                get = false;
-                break;
-            }
-            if(flt.contains("regexp"))
-            {
-                QRegularExpression rexp(flt.value("regexp").toString());
-                QRegularExpressionMatch match = rexp.match(vmrow.value(key).toString());
-                if(!match.hasMatch())
-                {
-                    get = false;
-                    break;
-                }
-            }
-        }
-        if(get)
+        sendError(cd, id, 29, errMsg, true);
+        delete q;
+        return;
+    }
+    if(!loadClassSecurities(cls, q->rows, &q->version))
+    {
+        sendError(cd, id, 28, QString("Failed to load securities of class %1").arg(cls), true);
+        delete q;
+        return;
+    }
+    QString ikey;
+    QStringList ivalues;
+    q->indexed = q->flt.indexableKey(ikey, ivalues) && refData.lookupClassSecurities(cls, ikey, ivalues, q->candidates);
+    answerRowsQuery(q, jobj);
+}
+
+void BridgeTCPServer::processQueryTableRequest(ConnectionData *cd, int id, QJsonObject &jobj)
+{
+    if(!jobj.contains("table"))
+    {
+        sendError(cd, id, 31, "'table' must be specified in queryTable", true);
+        return;
+    }
+    sendStdoutLine(QString("BridgeTCPServer::processQueryTableRequest(%1)").arg(id));
+    QString table = jobj.value("table").toString();
+    RowsQuery *q = new RowsQuery();
+    q->cd = cd;
+    q->id = id;
+    RowFilter flt;
+    QString errMsg;
+    if(!flt.parse(jobj.value("filters"), errMsg))
+    {
+        sendError(cd, id, 29, errMsg, true);
+        delete q;
+        return;
+    }
+    QStringList fields = jsonStringList(jobj, "fields", QString());
+    int limit = jobj.value("limit").toInt(0);
+    //фильтр, проекция и limit применяются в потоке луа, сюда приходят готовые строки
+    if(!qqBridge->queryTable(table, flt, fields, limit, q->rows, this))
+    {
+        sendError(cd, id, 32, QString("Failed to query table %1").arg(table), true);
+        delete q;
+        return;
+    }
+    //таблицы торговли не кешируются, поэтому курсоров нет: целиком или потоком порций
+    QJsonObject ansOpts;
+    if(jobj.contains("stream"))
+        ansOpts.insert("stream", jobj.value("stream"));
+    answerRowsQuery(q, ansOpts);
+}
+
+TableMirror *BridgeTCPServer::ensureMirror(ConnectionData *cd, int id, QString table)
+{
+    TableMirror *m = mirrors.value(table, nullptr);
+    if(m)
+        return m;
+    const TableMirrorSpec *spec = TableMirror::findSpec(table);
+    if(!spec)
+    {
+        sendError(cd, id, 33, QString("Table %1 can not be mirrored").arg(table), true);
+        return nullptr;
+    }
+    m = new TableMirror(*spec);
+    mirrors.insert(table, m);
+    quint32 tableBit = 1u << TableMirror::specIndex(spec);
+    mirroredTables.fetchAndOrRelease(tableBit);
+    //колбеки регистрируем до заполнения: строки, изменившиеся во время чтения таблицы,
+    //придут в очередь потока сервера и лягут поверх прочитанных
+    QStringList cbNames;
+    cbNames << m->callback();
+    if(!m->deleteCallback().isEmpty())
+        cbNames << m->deleteCallback();
+    foreach (QString name, cbNames)
+    {
+        if(!activeCallbacks.contains(name))
+        {
+            qqBridge->registerCallback(this, name);
+            activeCallbacks.append(name);
+        }
+        updateCallbackFilters(name);
+    }
+    QList<QVariantMap> rows;
+    if(!qqBridge->queryTable(table, RowFilter(), QStringList(), 0, rows, this))
+    {
+        mirrors.remove(table);
+        mirroredTables.fetchAndAndRelease(~tableBit);
+        foreach (QString name, cbNames)
+            updateCallbackFilters(name);
+        delete m;
+        sendError(cd, id, 34, QString("Failed to read table %1").arg(table), true);
+        return nullptr;
+    }
+    m->seed(rows);
+    sendStdoutLine(QString("Mirror of %1 seeded with %2 rows").arg(table).arg(m->count()));
+    return m;
+}
+
+void BridgeTCPServer::processQueryMirrorRequest(ConnectionData *cd, int id, QJsonObject &jobj)
+{
+    if(!jobj.contains("table"))
+    {
+        sendError(cd, id, 31, "'table' must be specified in queryMirror", true);
+        return;
+    }
+    sendStdoutLine(QString("BridgeTCPServer::processQueryMirrorRequest(%1)").arg(id));
+    RowsQuery *q = new RowsQuery();
+    q->cd = cd;
+    q->id = id;
+    QString errMsg;
+    if(!q->flt.parse(jobj.value("filters"), errMsg))
+    {
+        sendError(cd, id, 29, errMsg, true);
+        delete q;
+        return;
+    }
+    TableMirror *m = ensureMirror(cd, id, jobj.value("table").toString());
+    if(!m)
+    {
+        delete q;
+        return;
+    }
+    q->mirror = m;
+    q->fields = jsonStringList(jobj, "fields", QString());
+    QString index = m->select(q->flt, q->candidates);
+    sendStdoutLine(QString("Mirror of %1: %2 candidates by %3").arg(m->table()).arg(q->candidates.count())
+                   .arg(index.isEmpty() ? QString("full scan") : index));
+    q->indexed = true;
+    q->version = m->version();
+    answerRowsQuery(q, jobj);
+}
+
+void BridgeTCPServer::processSubscribeMirrorRequest(ConnectionData *cd, int id, QJsonObject &jobj)
+{
+    if(!jobj.contains("table"))
+    {
+        sendError(cd, id, 31, "'table' must be specified in subscribeMirror", true);
+        return;
+    }
+    sendStdoutLine(QString("BridgeTCPServer::processSubscribeMirrorRequest(%1)").arg(id));
+    QString table = jobj.value("table").toString();
+    int i;
+    for(i=0; i<mirrorSubscriptions.count(); i++)
+    {
+        if(mirrorSubscriptions.at(i).cd == cd && mirrorSubscriptions.at(i).table == table)
+        {
+            sendError(cd, id, 35, QString("You already subscribed to mirror of %1").arg(table), true);
+            return;
+        }
+    }
+    MirrorSubscription ms;
+    ms.cd = cd;
+    ms.id = id;
+    ms.table = table;
+    QString errMsg;
+    if(!ms.flt.parse(jobj.value("filters"), errMsg))
+    {
+        sendError(cd, id, 29, errMsg, true);
+        return;
+    }
+    ms.fields = jsonStringList(jobj, "fields", QString());
+    TableMirror *m = ensureMirror(cd, id, table);
+    if(!m)
+        return;
+    mirrorSubscriptions.append(ms);
+    QJsonObject subRes
+    {
+        {"table", table},
+        {"rows", m->count()}
+    };
+    QJsonObject ansRes
+    {
+        {"method", "return"},
+        {"result", subRes}
+    };
+    cd->proto->sendAns(id, ansRes);
+}
+
+void BridgeTCPServer::processUnsubscribeMirrorRequest(ConnectionData *cd, int id, QJsonObject &jobj)
+{
+    sendStdoutLine(QString("BridgeTCPServer::processUnsubscribeMirrorRequest(%1)").arg(id));
+    QString table = jobj.value("table").toString();
+    int i;
+    bool found = false;
+    for(i=mirrorSubscriptions.count()-1; i>=0; i--)
+    {
+        if(mirrorSubscriptions.at(i).cd == cd && mirrorSubscriptions.at(i).table == table)
         {
-            row = QJsonObject::fromVariantMap(vmrow);
-            table.append(row);
+            mirrorSubscriptions.removeAt(i);
+            found = true;
         }
     }
+    if(!found)
+    {
+        sendError(cd, id, 36, QString("You are not subscribed to mirror of %1").arg(table), true);
+        return;
+    }
+    QJsonObject ansRes
+    {
+        {"method", "return"},
+        {"result", true}
+    };
+    cd->proto->sendAns(id, ansRes);
+}
+
+void BridgeTCPServer::processInvokeRangeRequest(ConnectionData *cd, int id, QJsonObject &jobj)
+{
+    int objId = jobj.value("object").toInt(-1);
+    //порядок и повторы функций сохраняются: массивы ответа идут в том же порядке
+    QStringList funNames;
+    QJsonArray jfuns = jobj.value("functions").toArray();
+    int i;
+    for(i=0; i<jfuns.count(); i++)
+        funNames.append(jfuns.at(i).toString());
+    if(objId <= 0 || funNames.isEmpty())
+    {
+        sendError(cd, id, 41, "'object' and 'functions' must be specified in invokeRange", true);
+        return;
+    }
+    sendStdoutLine(QString("BridgeTCPServer::processInvokeRangeRequest(%1)").arg(id));
+    int from = jobj.value("from").toInt(1);
+    int to = jobj.value("to").toInt(from - 1);
+    if(to < from)
+    {
+        sendError(cd, id, 43, QString("Wrong range in invokeRange: to (%1) is less than from (%2)").arg(to).arg(from), true);
+        return;
+    }
+    //to ограничивается размером объекта (Size), а слишком длинный диапазон отвергается целиком,
+    //чтобы один запрос не занимал поток луа надолго
+    QList<QVariantList> columns;
+    QString errText;
+    if(!qqBridge->invokeObjectMethodRange(objId, funNames, from, to, invokeRangeMax, columns, this, &errText))
+    {
+        sendError(cd, id, 42, QString("invokeRange on object %1 failed: %2").arg(objId).arg(errText), true);
+        return;
+    }
+    QJsonArray jcolumns;
+    foreach (const QVariantList &col, columns)
+        jcolumns.append(QJsonArray::fromVariantList(col));
     QJsonObject invRes
     {
         {"method", "return"},
-        {"result", table}
+        {"result", jcolumns}
     };
     cd->proto->sendAns(id, invRes, false);
 }
 
+BarSeries *BridgeTCPServer::ensureBarSeries(ConnectionData *cd, int id, QJsonObject &jobj)
+{
+    if(!jobj.contains("class") || !jobj.contains("security") || !jobj.contains("interval"))
+    {
+        sendError(cd, id, 37, "'class', 'security' and 'interval' must be specified", true);
+        return nullptr;
+    }
+    QString cls = jobj.value("class").toString();
+    QString sec = jobj.value("security").toString();
+    double dinterval = jobj.value("interval").toDouble(-1);
+    int interval = (int)dinterval;
+    if(!jobj.value("interval").isDouble() || interval != dinterval || !BarSeries::isValidInterval(interval))
+    {
+        sendError(cd, id, 44, QString("Wrong interval %1: must be one of INTERVAL_* values").arg(jobj.value("interval").toVariant().toString()), true);
+        return nullptr;
+    }
+    QString key = BarSeries::makeKey(cls, sec, interval);
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    BarSeries *s = barSeries.value(key, nullptr);
+    if(s)
+    {
+        s->touch(now);
+        return s;
+    }
+    QVariantList args, res;
+    args << cls << sec << interval;
+    qqBridge->invokeMethod("CreateDataSource", args, res, this);
+    if(res.isEmpty() || !res.at(0).canConvert<QuikCallableObject>())
+    {
+        QString reason = (res.count() > 1) ? res.at(1).toString() : QString("CreateDataSource failed");
+        sendError(cd, id, 38, QString("Data source %1 %2 %3 is not created: %4").arg(cls).arg(sec).arg(interval).arg(reason), true);
+        return nullptr;
+    }
+    s = new BarSeries(cls, sec, interval);
+    s->setObjectId(res.at(0).value<QuikCallableObject>().objid);
+    s->touch(now);
+    //обновления общего источника копятся так же, как в режиме coalesced, но читает их сам сервер
+    FastCallbackFunctionData *fcfdata = new FastCallbackFunctionData("barsChange");
+    fcfdata->objId = s->objectId();
+    fcfdata->coalesced = true;
+    fcfdata->intervalMs = BARS_UPDATE_DEFAULT_INTERVAL_MS;
+    fcfdata->seriesKey = key;
+    BridgeCallableObject cobj;
+    cobj.data = reinterpret_cast<void *>(fcfdata);
+    cobj.handler = this;
+    args.clear();
+    res.clear();
+    args.append(QVariant::fromValue(cobj));
+    qqBridge->invokeObjectMethod(s->objectId(), "SetUpdateCallback", args, res, this);
+    barSeries.insert(key, s);
+    args.clear();
+    res.clear();
+    qqBridge->invokeObjectMethod(s->objectId(), "Size", args, res, this);
+    int n = res.isEmpty() ? 0 : res.at(0).toInt();
+    if(n > 0)
+        fillBarSeries(s, 1, n);
+    sendStdoutLine(QString("Data source %1 %2 %3 created with %4 bars").arg(cls).arg(sec).arg(interval).arg(s->size()));
+    if(!barsIdleTimer)
+    {
+        barsIdleTimer = new QTimer(this);
+        connect(barsIdleTimer, SIGNAL(timeout()), this, SLOT(closeIdleBarSeries()));
+        barsIdleTimer->start(BARS_IDLE_CLOSE_MS / 4);
+    }
+    return s;
+}
+
+//Возвращает последний прочитанный индекс: источник может оказаться короче запрошенного
+int BridgeTCPServer::fillBarSeries(BarSeries *s, int from, int to)
+{
+    from = qMax(1, from);
+    if(to < from)
+        return from - 1;
+    QStringList methods;
+    int i, c;
+    for(c=0; c<BarSeries::ColumnsCount; c++)
+        methods.append(BarSeries::columnMethod(c));
+    QList<QVariantList> columns;
+    if(!qqBridge->invokeObjectMethodRange(s->objectId(), methods, from, to, 0, columns, this))
+        return from - 1;
+    for(c=0; c<columns.count(); c++)
+    {
+        for(i=0; i<columns.at(c).count(); i++)
+            s->setValue(c, from + i, columns.at(c).at(i));
+    }
+    if(s->size() > 0)
+        s->setReady();
+    return to;
+}
+
+void BridgeTCPServer::updateBarSeries(QString key, int from, int to)
+{
+    BarSeries *s = barSeries.value(key, nullptr);
+    if(!s)
+        return;
+    //история источника догружается асинхронно: заодно дочитываем свечи, пропущенные до from
+    from = qMax(1, qMin(from, s->size() + 1));
+    if(to < from)
+        return;
+    to = qMin(fillBarSeries(s, from, to), s->size());
+    QByteArray body;
+    int i;
+    if(s->isReady())
+    {
+        for(i=0; i<pendingBarsRequests.count(); )
+        {
+            if(pendingBarsRequests.at(i).key == key)
+            {
+                PendingBarsRequest pr = pendingBarsRequests.takeAt(i);
+                answerBarsRequest(pr.cd, pr.id, s, pr.req);
+            }
+            else
+                i++;
+        }
+    }
+    //источник короче накопленного диапазона (например, после сброса): рассылать нечего
+    if(to < from)
+        return;
+    for(i=0; i<barsSubscriptions.count(); i++)
+    {
+        const BarsSubscription &bs = barsSubscriptions.at(i);
+        if(bs.key != key)
+            continue;
+        if(body.isEmpty())
+        {
+            QJsonObject chMsg = s->columns(from, to);
+            chMsg.insert("method", "barsChange");
+            chMsg.insert("class", s->classCode());
+            chMsg.insert("security", s->securityCode());
+            chMsg.insert("interval", s->interval());
+            chMsg.insert("from", from);
+            chMsg.insert("to", to);
+            body = jsonBody(chMsg);
+        }
+        bs.cd->proto->sendReqData(bs.id, body, false);
+    }
+}
+
+void BridgeTCPServer::processGetBarsRequest(ConnectionData *cd, int id, QJsonObject &jobj)
+{
+    sendStdoutLine(QString("BridgeTCPServer::processGetBarsRequest(%1)").arg(id));
+    BarSeries *s = ensureBarSeries(cd, id, jobj);
+    if(!s)
+        return;
+    if(!s->isReady())
+    {
+        //только что созданный источник ещё пуст: отвечаем после первого заполнения
+        PendingBarsRequest pr;
+        pr.cd = cd;
+        pr.id = id;
+        pr.key = s->key();
+        pr.req = jobj;
+        pr.due = QDateTime::currentMSecsSinceEpoch() + BARS_READY_TIMEOUT_MS;
+        pendingBarsRequests.append(pr);
+        QTimer::singleShot(BARS_READY_TIMEOUT_MS, this, SLOT(answerPendingBarsRequests()));
+        return;
+    }
+    answerBarsRequest(cd, id, s, jobj);
+}
+
+void BridgeTCPServer::answerBarsRequest(ConnectionData *cd, int id, BarSeries *s, const QJsonObject &jobj)
+{
+    int n = s->size();
+    int from = qMax(1, jobj.value("from").toInt(1));
+    int to = qMin(n, jobj.value("to").toInt(n));
+    QJsonObject bars = s->columns(from, qMax(from - 1, to));
+    bars.insert("size", n);
+    bars.insert("from", from);
+    bars.insert("to", qMax(from - 1, to));
+    bars.insert("ready", s->isReady());
+    QJsonObject ansRes
+    {
+        {"method", "return"},
+        {"result", bars}
+    };
+    cd->proto->sendAns(id, ansRes, false);
+}
+
+void BridgeTCPServer::processSubscribeBarsRequest(ConnectionData *cd, int id, QJsonObject &jobj)
+{
+    sendStdoutLine(QString("BridgeTCPServer::processSubscribeBarsRequest(%1)").arg(id));
+    BarSeries *s = ensureBarSeries(cd, id, jobj);
+    if(!s)
+        return;
+    int i;
+    for(i=0; i<barsSubscriptions.count(); i++)
+    {
+        if(barsSubscriptions.at(i).cd == cd && barsSubscriptions.at(i).key == s->key())
+        {
+            sendError(cd, id, 39, QString("You already subscribed to bars of %1 %2 %3").arg(s->classCode()).arg(s->securityCode()).arg(s->interval()), true);
+            return;
+        }
+    }
+    BarsSubscription bs;
+    bs.cd = cd;
+    bs.id = id;
+    bs.key = s->key();
+    barsSubscriptions.append(bs);
+    s->addSubscriber();
+    QJsonObject subRes
+    {
+        {"class", s->classCode()},
+        {"security", s->securityCode()},
+        {"interval", s->interval()},
+        {"size", s->size()},
+        {"ready", s->isReady()}
+    };
+    QJsonObject ansRes
+    {
+        {"method", "return"},
+        {"result", subRes}
+    };
+    cd->proto->sendAns(id, ansRes);
+}
+
+void BridgeTCPServer::processUnsubscribeBarsRequest(ConnectionData *cd, int id, QJsonObject &jobj)
+{
+    sendStdoutLine(QString("BridgeTCPServer::processUnsubscribeBarsRequest(%1)").arg(id));
+    QString key = BarSeries::makeKey(jobj.value("class").toString(), jobj.value("security").toString(), jobj.value("interval").toInt());
+    int i;
+    bool found = false;
+    for(i=barsSubscriptions.count()-1; i>=0; i--)
+    {
+        if(barsSubscriptions.at(i).cd == cd && barsSubscriptions.at(i).key == key)
+        {
+            barsSubscriptions.removeAt(i);
+            found = true;
+        }
+    }
+    if(!found)
+    {
+        sendError(cd, id, 40, "You are not subscribed to these bars", true);
+        return;
+    }
+    BarSeries *s = barSeries.value(key, nullptr);
+    if(s && s->removeSubscriber() == 0)
+        releaseBarSeries(key);
+    QJsonObject ansRes
+    {
+        {"method", "return"},
+        {"result", true}
+    };
+    cd->proto->sendAns(id, ansRes);
+}
+
 void BridgeTCPServer::processSubscribeParamChangesRequest(ConnectionData *cd, int id, QJsonObject &jobj)
 {
     if(!jobj.contains("class"))
@@ -441,12 +1485,16 @@ void BridgeTCPServer::processSubscribeParamChangesRequest(ConnectionData *cd, in
     }
     sendStdoutLine(QString("BridgeTCPServer::processSubscribeParamChangesRequest(%1)").arg(id));
     QString cls = jobj.value("class").toString();
-    cacheSecClasses();
-    if(!secClasses.contains(cls, Qt::CaseInsensitive))
+    if(!secClasses().contains(cls, Qt::CaseInsensitive))
     {
         sendError(cd, id, 7, QString("Unknown securities class %1").arg(cls), true);
         return;
     }
+    if(isBulkParamRequest(jobj))
+    {
+        processBulkParamSubscription(cd, id, cls, true, jobj);
+        return;
+    }
     if(!jobj.contains("security"))
     {
         sendError(cd, id, 9, "'security' must be specified in subscribeParamChanges", true);
@@ -459,10 +1507,10 @@ void BridgeTCPServer::processSubscribeParamChangesRequest(ConnectionData *cd, in
         return;
     }
     QString par = jobj.value("param").toString();
-    ParamSubs *p=paramSubscriptions.findParamSubscriptions(cls, sec, par);
+    ParamEntry *p = paramSubscriptions.findParam(cls, sec, par);
     if(p)
     {
-        if(p->hasConsumer(cd)) //p->consumers.contains(cd))
+        if(p->findConsumer(cd))
         {
             sendError(cd, id, 11, QString("You already subscribed %1/%2/%3").arg(cls, sec, par), true);
             return;
@@ -479,7 +1527,14 @@ void BridgeTCPServer::processSubscribeParamChangesRequest(ConnectionData *cd, in
             sendStderrLine("ParamRequest failed");
     }
     sendStderrLine("We are ready to add subscription");
-    paramSubscriptions.addConsumer(cd, cls, sec, par, id);
+    ParamConsumer *pc = paramSubscriptions.addConsumer(cd, cls, sec, par, id);
+    if(!pc)
+    {
+        sendError(cd, id, 23, QString("Subscription index is full, can't subscribe %1/%2/%3").arg(cls, sec, par), true);
+        return;
+    }
+    applyParamConsumerOptions(pc, jobj);
+    updateSecurityInterest();
     QJsonObject subsRes
     {
         {"method", "return"},
@@ -498,12 +1553,16 @@ void BridgeTCPServer::processUnsubscribeParamChangesRequest(ConnectionData *cd,
     }
     sendStdoutLine(QString("BridgeTCPServer::processUnsubscribeParamChangesRequest(%1)").arg(id));
     QString cls = jobj.value("class").toString();
-    cacheSecClasses();
-    if(!secClasses.contains(cls, Qt::CaseInsensitive))
+    if(!secClasses().contains(cls, Qt::CaseInsensitive))
     {
         sendError(cd, id, 7, QString("Unknown securities class %1").arg(cls), true);
         return;
     }
+    if(isBulkParamRequest(jobj))
+    {
+        processBulkParamSubscription(cd, id, cls, false, jobj);
+        return;
+    }
     if(!jobj.contains("security"))
     {
         sendError(cd, id, 13, "'security' must be specified in unsubscribeParamChanges", true);
@@ -518,7 +1577,8 @@ void BridgeTCPServer::processUnsubscribeParamChangesRequest(ConnectionData *cd,
     QString par = jobj.value("param").toString();
     sendStdoutLine(QString("Try delete subscription to %1/%2/%3").arg(cls, sec, par));
     paramSubscriptions.delConsumer(cd, cls, sec, par);
-    if(paramSubscriptions.findParamSubscriptions(cls, sec, par))
+    updateSecurityInterest();
+    if(paramSubscriptions.findParam(cls, sec, par))
         sendStdoutLine(QString("There are some consumers subscribed to %1/%2/%3. Param left in DB").arg(cls, sec, par));
     else
     {
@@ -538,6 +1598,161 @@ void BridgeTCPServer::processUnsubscribeParamChangesRequest(ConnectionData *cd,
     cd->proto->sendAns(id, usubsRes, false);
 }
 
+void BridgeTCPServer::processBulkParamSubscription(ConnectionData *cd, int id, QString cls, bool subscribe, QJsonObject &jobj)
+{
+    QString reqName = subscribe ? "subscribeParamChanges" : "unsubscribeParamChanges";
+    sendStdoutLine(QString("BridgeTCPServer::processBulkParamSubscription(%1, %2)").arg(id).arg(reqName));
+    QStringList secs;
+    if(jobj.value("security").toString() == "*")
+    {
+        if(subscribe)
+            secs = classSecurityCodes(cls);
+        else
+        {
+            //отписка от всего класса - только от того, на что реально подписаны
+            QList<SecurityKey> paramSecs, quoteSecs;
+            paramSubscriptions.collectSecurities(paramSecs, quoteSecs);
+            int k;
+            for(k=0; k<paramSecs.count(); k++)
+            {
+                if(paramSecs.at(k).first == cls)
+                    secs.append(paramSecs.at(k).second);
+            }
+        }
+    }
+    else
+        secs = jsonStringList(jobj, "securities", "security");
+    if(secs.isEmpty() && jobj.value("security").toString() != "*")
+    {
+        sendError(cd, id, subscribe ? 9 : 13, QString("'security' or 'securities' must be specified in %1").arg(reqName), true);
+        return;
+    }
+    QStringList pars = jsonStringList(jobj, "params", "param");
+    if(pars.isEmpty())
+    {
+        sendError(cd, id, subscribe ? 10 : 14, QString("'param' or 'params' must be specified in %1").arg(reqName), true);
+        return;
+    }
+    QList<QVariantList> luaReqs;
+    int done = 0, skipped = 0;
+    int i, j;
+    for(i=0; i<secs.count(); i++)
+    {
+        for(j=0; j<pars.count(); j++)
+        {
+            const QString &sec = secs.at(i);
+            const QString &par = pars.at(j);
+            ParamEntry *p = paramSubscriptions.findParam(cls, sec, par);
+            if(subscribe)
+            {
+                if(p && p->findConsumer(cd))
+                {
+                    skipped++;
+                    continue;
+                }
+                ParamConsumer *pc = paramSubscriptions.addConsumer(cd, cls, sec, par, id);
+                if(!pc)
+                {
+                    skipped++;
+                    continue;
+                }
+                applyParamConsumerOptions(pc, jobj);
+                if(!p)
+                    luaReqs.append(QVariantList() << cls << sec << par);
+                done++;
+            }
+            else
+            {
+                if(!p || !p->findConsumer(cd))
+                {
+                    skipped++;
+                    continue;
+                }
+                paramSubscriptions.delConsumer(cd, cls, sec, par);
+                if(!paramSubscriptions.findParam(cls, sec, par))
+                    luaReqs.append(QVariantList() << cls << sec << par);
+                done++;
+            }
+        }
+    }
+    //заказ (или отмена) параметров у квика одним проходом в луа
+    if(!luaReqs.isEmpty())
+    {
+        QVariantList luaRes;
+        if(!qqBridge->invokeMethodBatch(subscribe ? "ParamRequest" : "CancelParamRequest", luaReqs, luaRes, this))
+            sendStderrLine(QString("%1: batch of %2 requests failed").arg(reqName).arg(luaReqs.count()));
+    }
+    updateSecurityInterest();
+    QJsonObject bulkRes
+    {
+        {"method", "return"},
+        {"result", true},
+        {"count", done},
+        {"skipped", skipped}
+    };
+    cd->proto->sendAns(id, bulkRes, false);
+    if(!subscribe || !done)
+        return;
+    //начальный снимок заказанных значений: первая порция сразу, остальные (подписка на
+    //весь класс) по одной за заход в цикл событий, чтобы не держать сервер на тысячах бумаг
+    ParamsSnapshotStream s;
+    s.cd = cd;
+    s.id = id;
+    s.cls = cls;
+    s.secs = secs;
+    s.pars = pars;
+    s.pos = 0;
+    if(!sendParamsSnapshotChunk(s))
+        return;
+    bool idle = paramSnapshots.isEmpty();
+    paramSnapshots.append(s);
+    if(idle)
+        QTimer::singleShot(0, this, SLOT(continueParamSnapshots()));
+}
+
+//Отправляет очередную порцию снимка параметров. Возвращает true, если бумаги ещё остались
+bool BridgeTCPServer::sendParamsSnapshotChunk(ParamsSnapshotStream &s)
+{
+    QJsonObject snapshot;
+    int end = qMin(s.secs.count(), s.pos + PARAMS_SNAPSHOT_CHUNK);
+    int i, j;
+    for(i=s.pos; i<end; i++)
+    {
+        const QString &sec = s.secs.at(i);
+        QVariantList pvalues;
+        if(!qqBridge->fetchParams(s.cls, sec, s.pars, pvalues, this))
+            continue;
+        QJsonObject secValues;
+        for(j=0; j<s.pars.count(); j++)
+        {
+            ParamEntry *p = paramSubscriptions.findParam(s.cls, sec, s.pars.at(j));
+            ParamConsumer *pc = p ? p->findConsumer(s.cd) : nullptr;
+            //в снимок попадает только то, на что подписал именно этот запрос
+            if(!pc || pc->id != s.id)
+                continue;
+            //значение параметра общее: задаём его, только если его ещё никто не получил,
+            //иначе другие подписчики пропустили бы изменение относительно своего последнего
+            if(!p->value.isValid())
+                p->value = pvalues.at(j);
+            pc->lastSentValue = pvalues.at(j);
+            secValues.insert(s.pars.at(j), QJsonValue::fromVariant(pvalues.at(j)));
+        }
+        if(!secValues.isEmpty())
+            snapshot.insert(sec, secValues);
+    }
+    s.pos = end;
+    bool more = (s.pos < s.secs.count());
+    QJsonObject snapMsg
+    {
+        {"method", "paramsSnapshot"},
+        {"class", s.cls},
+        {"securities", snapshot},
+        {"more", more}
+    };
+    s.cd->proto->sendReq(s.id, snapMsg, false);
+    return more;
+}
+
 void BridgeTCPServer::processExtendedAnswers(ConnectionData *cd, int id, QString method, QJsonObject &jobj)
 {
 
@@ -552,8 +1767,7 @@ void BridgeTCPServer::processSubscribeQuotesRequest(ConnectionData *cd, int id,
     }
     sendStdoutLine(QString("BridgeTCPServer::processSubscribeQuotesRequest(%1)").arg(id));
     QString cls = jobj.value("class").toString();
-    cacheSecClasses();
-    if(!secClasses.contains(cls, Qt::CaseInsensitive))
+    if(!secClasses().contains(cls, Qt::CaseInsensitive))
     {
         sendError(cd, id, 16, QString("Unknown securities class %1").arg(cls), true);
         return;
@@ -564,13 +1778,21 @@ void BridgeTCPServer::processSubscribeQuotesRequest(ConnectionData *cd, int id,
         return;
     }
     QString sec = jobj.value("security").toString();
-    SecSubs *s = paramSubscriptions.findSecuritySubscriptions(cls, sec);
-    if(s && s->hasQuotesConsumer(cd)) //s->quoteConsumers.contains(cd))
+    SecurityEntry *s = paramSubscriptions.findSecurity(cls, sec);
+    if(s && s->findQuoteConsumer(cd))
     {
         sendError(cd, id, 18, QString("You already subscriped %1/%2 quotes").arg(cls, sec), true);
         return;
     }
-    else
+    //подписка квика на стакан одна на бумагу: заказываем её только для первого подписчика
+    bool firstConsumer = (!s || s->quoteConsumers.isEmpty());
+    QuoteConsumer *qc = paramSubscriptions.addQuotesConsumer(cd, cls, sec, id);
+    if(!qc)
+    {
+        sendError(cd, id, 24, QString("Subscription index is full, can't subscribe %1/%2 quotes").arg(cls, sec), true);
+        return;
+    }
+    if(firstConsumer)
     {
         QVariantList args, res;
         args << cls << sec;
@@ -578,7 +1800,23 @@ void BridgeTCPServer::processSubscribeQuotesRequest(ConnectionData *cd, int id,
         if(!res[0].toBool())
             sendStderrLine("Subscribe_Level_II_Quotes returned false");
     }
-    paramSubscriptions.addQuotesConsumer(cd, cls, sec, id);
+    qc->delta = (jobj.value("mode").toString() == "delta");
+    qc->depth = qMax(0, jobj.value("depth").toInt(0));
+    qc->numeric = (jobj.value("format").toString() == "numeric");
+    SecurityEntry *se = paramSubscriptions.findSecurity(cls, sec);
+    if(qc->numeric && se && se->scale < 0)
+    {
+        QVariantList args, res;
+        args << cls << sec;
+        qqBridge->invokeMethod("getSecurityInfo", args, res, this);
+        se->scale = res.isEmpty() ? 0 : qMax(0, res[0].toMap().value("scale").toInt());
+        //стакан мог быть разобран с другим масштабом - пусть delta-подписчики начнут с нуля
+        se->book.clear();
+        foreach (QuoteConsumer *oqc, se->quoteConsumers)
+            oqc->needSnapshot = oqc->needSnapshot || oqc->delta;
+    }
+    qc->snapshotEvery = qMax(0, jobj.value("snapshotEvery").toInt(0));
+    updateSecurityInterest();
     QJsonObject subsRes
     {
         {"method", "return"},
@@ -597,8 +1835,7 @@ void BridgeTCPServer::processUnsubscribeQuotesRequest(ConnectionData *cd, int id
         return;
     }
     QString cls = jobj.value("class").toString();
-    cacheSecClasses();
-    if(!secClasses.contains(cls, Qt::CaseInsensitive))
+    if(!secClasses().contains(cls, Qt::CaseInsensitive))
     {
         sendError(cd, id, 20, QString("Unknown securities class %1").arg(cls), true);
         return;
@@ -609,9 +1846,12 @@ void BridgeTCPServer::processUnsubscribeQuotesRequest(ConnectionData *cd, int id
         return;
     }
     QString sec = jobj.value("security").toString();
+    //от стакана квика отписываемся, только когда уходит последний его подписчик
+    SecurityEntry *s = paramSubscriptions.findSecurity(cls, sec);
+    bool lastConsumer = s && s->findQuoteConsumer(cd) && s->quoteConsumers.count() == 1;
     paramSubscriptions.delQuotesConsumer(cd, cls, sec);
-    SecSubs *s = paramSubscriptions.findSecuritySubscriptions(cls, sec);
-    if(!s || !s->hasQuotesConsumer()) //s->quoteConsumers.isEmpty())
+    updateSecurityInterest();
+    if(lastConsumer)
     {
         QVariantList args, res;
         args << cls << sec;
@@ -627,6 +1867,96 @@ void BridgeTCPServer::processUnsubscribeQuotesRequest(ConnectionData *cd, int id
     cd->proto->sendAns(id, usubsRes, false);
 }
 
+void BridgeTCPServer::processRequestQuotesSnapshotRequest(ConnectionData *cd, int id, QJsonObject &jobj)
+{
+    sendStdoutLine(QString("BridgeTCPServer::processRequestQuotesSnapshotRequest(%1)").arg(id));
+    if(!jobj.contains("class") || !jobj.contains("security"))
+    {
+        sendError(cd, id, 25, "'class' and 'security' must be specified in requestQuotesSnapshot", true);
+        return;
+    }
+    QString cls = jobj.value("class").toString();
+    QString sec = jobj.value("security").toString();
+    SecurityEntry *s = paramSubscriptions.findSecurity(cls, sec);
+    QuoteConsumer *qc = s ? s->findQuoteConsumer(cd) : nullptr;
+    if(!qc)
+    {
+        sendError(cd, id, 26, QString("You are not subscribed to %1/%2 quotes").arg(cls, sec), true);
+        return;
+    }
+    QJsonObject snapRes
+    {
+        {"method", "return"},
+        {"result", true}
+    };
+    cd->proto->sendAns(id, snapRes, false);
+    const QuoteBook &book = (qc->depth > 0) ? qc->lastBook : s->book;
+    if(qc->delta && book.isValid())
+    {
+        cd->proto->sendReq(qc->id, quotesSnapshotMessage(cls, sec, book, qc->numeric, s->scale), false);
+        qc->needSnapshot = false;
+        qc->sinceSnapshot = 0;
+    }
+    else
+    {
+        qc->needSnapshot = true;
+        secQuotesUpdate(cls, sec);
+    }
+}
+
+void BridgeTCPServer::processGetStatisticsRequest(ConnectionData *cd, int id, QJsonObject &jobj)
+{
+    sendStdoutLine(QString("BridgeTCPServer::processGetStatisticsRequest(%1)").arg(id));
+    QJsonObject mirrorStats;
+    foreach (TableMirror *m, mirrors)
+        mirrorStats.insert(m->table(), m->count());
+    QJsonObject stats
+    {
+        {"onParamEvents", (qint64)updateQueue.eventsCount(SecurityUpdateQueue::ParamsUpdate)},
+        {"onParamCoalesced", (qint64)updateQueue.coalescedCount(SecurityUpdateQueue::ParamsUpdate)},
+        {"onQuoteEvents", (qint64)updateQueue.eventsCount(SecurityUpdateQueue::QuotesUpdate)},
+        {"onQuoteCoalesced", (qint64)updateQueue.coalescedCount(SecurityUpdateQueue::QuotesUpdate)},
+        {"updateWakeups", (qint64)updateQueue.wakeupsCount()},
+        {"onParamFiltered", (qint64)securityInterest.rejectedCount(SecurityInterestSet::Params)},
+        {"onQuoteFiltered", (qint64)securityInterest.rejectedCount(SecurityInterestSet::Quotes)},
+        {"subscribedSecurities", paramSubscriptions.securitiesCount()},
+        {"subscribedParams", paramSubscriptions.paramsCount()},
+        {"refDataHits", (qint64)refData.hitsCount()},
+        {"refDataMisses", (qint64)refData.missesCount()},
+        {"refDataClasses", refData.cachedClassesCount()},
+        {"refSnapshotClasses", refSnapshot.classesCount()},
+        {"mirrors", mirrorStats},
+        {"dataSources", barSeries.count()}
+    };
+    QJsonObject statRes
+    {
+        {"method", "return"},
+        {"result", stats}
+    };
+    cd->proto->sendAns(id, statRes, false);
+}
+
+void BridgeTCPServer::processEnableTimestampsRequest(ConnectionData *cd, int id, QJsonObject &jobj)
+{
+    sendStdoutLine(QString("BridgeTCPServer::processEnableTimestampsRequest(%1)").arg(id));
+    connectionsMutex.lock();
+    cd->timestamps = jobj.value("enabled").toBool(true);
+    connectionsMutex.unlock();
+    cd->proto->setWriteTimestamps(cd->timestamps);
+    //привязка монотонных меток к настенным часам: клиент пересчитывает по ней метки в время
+    QJsonObject tsInfo
+    {
+        {"enabled", cd->timestamps},
+        {"anchor", eventClockAnchor()}
+    };
+    QJsonObject tsRes
+    {
+        {"method", "return"},
+        {"result", tsInfo}
+    };
+    cd->proto->sendAns(id, tsRes);
+}
+
 void BridgeTCPServer::incomingConnection(qintptr handle)
 {
     Qt::HANDLE thh = QThread::currentThreadId();
@@ -652,6 +1982,7 @@ void BridgeTCPServer::incomingConnection(qintptr handle)
         logPath = logPathPrefix+sock->peerAddress().toString()+".log";
     }
     ConnectionData *cd = new ConnectionData();
+    cd->connId = ++lastConnectionId;
     cd->srv = this;
     cd->threadId = thh;
     cd->peerIp = sock->peerAddress().toString();
@@ -673,7 +2004,9 @@ void BridgeTCPServer::incomingConnection(qintptr handle)
 
 void BridgeTCPServer::connectionEstablished(ConnectionData *cd)
 {
+    connectionsMutex.lock();
     m_connections.append(cd);
+    connectionsMutex.unlock();
     cd->proto->sendVer(BRIDGE_SERVER_PROTOCOL_VERSION);
     cd->versionSent = true;
 }
@@ -720,19 +2053,64 @@ void BridgeTCPServer::protoReqArrived(int id, QJsonValue data)
             sendError(cd, id, 3, QString("Callback %1 already registered").arg(callbackName), true);
             return;
         }
+        CallbackFilter flt;
+        QString fltErr;
+        if(!flt.parse(reqObj.value("filter"), reqObj.value("fields"), fltErr))
+        {
+            sendError(cd, id, 22, QString("Wrong filter for callback %1: %2").arg(callbackName, fltErr), true);
+            return;
+        }
         if(!activeCallbacks.contains(callbackName))
         {
             qqBridge->registerCallback(this, callbackName);
             activeCallbacks.append(callbackName);
         }
+        bool journaled = journal.isJournaled(callbackName);
+        QList<CallbackJournalEvent> replay;
+        bool replayComplete = true;
+        qint64 lastSeq = 0;
+        if(journaled)
+            journal.mutex.lock();
+        connectionsMutex.lock();
         cd->callbackSubscriptions.insert(callbackName, id);
+        if(!flt.isEmpty())
+            cd->callbackFilters.insert(callbackName, flt);
+        connectionsMutex.unlock();
+        updateCallbackFilters(callbackName);
+        updateSecurityInterest();
+        if(journaled)
+        {
+            if(reqObj.contains("fromSeq"))
+                replayComplete = journal.eventsFrom((qint64)reqObj.value("fromSeq").toDouble(), callbackName, replay);
+            lastSeq = journal.lastSeq();
+            journal.mutex.unlock();
+        }
         QJsonObject regRes
         {
             {"method", "registered"},
             {"callback", callbackName}
         };
+        if(journaled)
+        {
+            regRes.insert("seq", lastSeq);
+            regRes.insert("epoch", journal.getEpoch());
+            if(reqObj.contains("fromSeq"))
+            {
+                regRes.insert("replayed", replay.count());
+                regRes.insert("gap", !replayComplete);
+            }
+        }
         // qDebug() << "Сall safeSendAns from BridgeTCPServer::protoReqArrived 1";
         safeSendAns(cd, id, regRes, false);
+        //пропущенные события уходят до живых: живые ставятся в очередь потока сервера
+        int k;
+        for(k=0; k<replay.count(); k++)
+        {
+            const CallbackJournalEvent &ev = replay.at(k);
+            if(!flt.matchArguments(ev.args))
+                continue;
+            safeSendReq(cd, id, callbackMessage(ev.name, ev.seq, flt.projectArguments(ev.args)), false);
+        }
         return;
     }
     if(method == "invoke")
@@ -773,6 +2151,14 @@ void BridgeTCPServer::protoReqArrived(int id, QJsonValue data)
                                 fcfdata->cd = cd;
                                 fcfdata->objId = objId;
                                 fcfdata->funName = fname;
+                                if(pcabl.value("mode").toString() == "coalesced")
+                                {
+                                    fcfdata->coalesced = true;
+                                    fcfdata->intervalMs = pcabl.value("intervalMs", BARS_UPDATE_DEFAULT_INTERVAL_MS).toInt();
+                                    if(fcfdata->intervalMs < 0)
+                                        fcfdata->intervalMs = 0;
+                                    fcfdata->reqId = id;
+                                }
                                 cobj.data = reinterpret_cast<void *>(fcfdata);
                                 cobj.handler = this;
                                 args.append(QVariant::fromValue(cobj));
@@ -915,9 +2301,7 @@ void BridgeTCPServer::protoFinished()
     {
         QString msg = QString("Connection %1 closed").arg(cd->peerIp);
         sendStdoutLine(msg);
-        m_connections.removeAll(cd);
-        paramSubscriptions.clearAllSubscriptions(cd);
-        delete cd;
+        removeConnection(cd);
     }
 }
 
@@ -927,9 +2311,7 @@ void BridgeTCPServer::protoError(QAbstractSocket::SocketError err)
     if(cd)
     {
         sendStderrLine(QString("Socket error %1: ").arg((int)err)+cd->proto->lastErrorString());
-        m_connections.removeAll(cd);
-        paramSubscriptions.clearAllSubscriptions(cd);
-        delete cd;
+        removeConnection(cd);
     }
 }
 
@@ -957,90 +2339,285 @@ void BridgeTCPServer::fastCallbackRequestHandler(ConnectionData *cd, int oid, QS
     }
 }
 
-void BridgeTCPServer::secParamsUpdate(QString cls, QString sec)
+void BridgeTCPServer::secParamsUpdate(QString cls, QString sec, qint64 entryNs)
 {
-    SecSubs *s = paramSubscriptions.findSecuritySubscriptions(cls, sec);
-    if(s)
+    qint64 dqNs = monotonicNs();
+    SecurityEntry *s = paramSubscriptions.findSecurity(cls, sec);
+    if(!s || s->params.isEmpty())
+        return;
+    sendStdoutLine(QString("BridgeTCPServer::secParamsUpdate(%1, %2) -> subscription found").arg(cls, sec));
+    paramSubscriptions.beginRead();
+    QList<ParamEntry *> plist = s->params;
+    //все параметры бумаги читаются одним проходом в луа
+    QStringList pnames;
+    int i,j;
+    for(i=0; i<plist.count(); i++)
+        pnames.append(plist.at(i)->param);
+    QVariantList pvalues;
+    GroupedParamsMap groups;
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if(!qqBridge->fetchParams(cls, sec, pnames, pvalues, this))
+    {
+        paramSubscriptions.endRead();
+        return;
+    }
+    QJsonObject stamps = stageStamps(entryNs, dqNs, monotonicNs());
+    for(i=0; i<plist.count(); i++)
     {
-        sendStdoutLine(QString("BridgeTCPServer::secParamsUpdate(%1, %2) -> subscription found").arg(cls, sec));
-        QStringList allParams = s->getParamsList(); //s->params.keys();
-        QString par;
-        ParamSubs *p;
-        int i,j;
-        for(i=0; i<allParams.count();i++)
+        ParamEntry *p = plist.at(i);
+        if(p->removed)
         {
-            par = allParams[i];
-            sendStdoutLine(QString("BridgeTCPServer::secParamsUpdate(%1, %2) -> check param %3").arg(cls, sec, par));
-            QVariantList args, res;
-            args << cls << sec << par;
-            qqBridge->invokeMethod("getParamEx2", args, res, this);
-            QVariantMap mres = res[0].toMap();
-            QVariant pval = mres["param_value"];
-            sendStdoutLine(QString("Search subscription for %1").arg(par));
-            p = s->findParamSubscriptions(par);
-            if(!p)
-            {
-                sendStdoutLine(QString("Parameter %1 subscription was canceled").arg(par));
-                continue;
-            }
-            if(pval == p->value)
-            {
-                sendStdoutLine(QString("Value of %1 wasn't changed").arg(par));
-                continue;
-            }
-            sendStdoutLine(QString("Value of %1 was changed. Send it to consumers").arg(par));
-            p->value = pval;
-            QJsonObject subsAns
-            {
-                {"method", "paramChange"},
-                {"class", cls},
-                {"security", sec},
-                {"param", par},
-                {"value", QJsonValue::fromVariant(pval)}
-            };
-            QList<ConnectionData *> consList = p->consumersList(); //p->consumers.keys();
-            for(j=0; j<consList.count(); j++)
-            {
-                ConnectionData *cd = consList.at(j);
-                int id = p->getSubscriptionId(cd); //p->consumers.value(cd);
-                if(id >= 0)
-                    cd->proto->sendReq(id, subsAns, false);
-            }
+            sendStdoutLine(QString("Parameter %1 subscription was canceled").arg(p->param));
+            continue;
+        }
+        QVariant pval = pvalues.at(i);
+        if(pval == p->value)
+            continue;
+        sendStdoutLine(QString("Value of %1 was changed. Send it to consumers").arg(p->param));
+        p->value = pval;
+        //тело сериализуется один раз, всем подписчикам уходят одни и те же байты
+        NotificationBody subsAns(jsonBody(paramChangeMessage(cls, sec, p->param, pval)), stamps);
+        QList<ParamConsumer *> consList = p->consumers;
+        for(j=0; j<consList.count(); j++)
+        {
+            ParamConsumer *pc = consList.at(j);
+            if(!pc->removed)
+                offerParamChange(p, pc, pval, subsAns, now, groups);
         }
     }
-    //else
-    //    sendStderrLine(QString("BridgeTCPServer::secParamsUpdate(%1, %2) -> subscription not found").arg(cls, sec));
+    sendGroupedParams(groups);
+    paramSubscriptions.endRead();
+}
+
+void BridgeTCPServer::offerParamChange(ParamEntry *p, ParamConsumer *pc, const QVariant &pval, NotificationBody &msg, qint64 now, GroupedParamsMap &groups)
+{
+    if(!pc->passesDeadband(pval))
+    {
+        //значение вернулось в зону около отправленного - ожидающее уже не нужно
+        pc->pending = false;
+        pc->pendingValue = QVariant();
+        return;
+    }
+    if(pc->minIntervalMs <= 0 || (!pc->pending && now - pc->lastSentMs >= pc->minIntervalMs))
+    {
+        deliverParamChange(p, pc, pval, msg, groups);
+        pc->lastSentMs = now;
+        pc->lastSentValue = pval;
+        return;
+    }
+    //слишком рано: запоминаем последнее значение, отправит колесо таймеров
+    pc->pendingValue = pval;
+    if(pc->pending)
+        return;
+    pc->pending = true;
+    PendingParamSend pps;
+    pps.key = p->key;
+    pps.cd = pc->cd;
+    paramWheel.schedule(pps, pc->lastSentMs + pc->minIntervalMs);
+    if(!paramWheelTimer)
+    {
+        paramWheelTimer = new QTimer(this);
+        paramWheelTimer->setInterval(paramWheel.tickMs());
+        connect(paramWheelTimer, SIGNAL(timeout()), this, SLOT(flushParamWheel()));
+    }
+    if(!paramWheelTimer->isActive())
+        paramWheelTimer->start();
+}
+
+void BridgeTCPServer::deliverParamChange(ParamEntry *p, ParamConsumer *pc, const QVariant &pval, NotificationBody &msg, GroupedParamsMap &groups)
+{
+    if(!pc->grouped)
+    {
+        pc->cd->proto->sendReqData(pc->id, msg.bytes(pc->cd->timestamps), false);
+        return;
+    }
+    QPair<ConnectionData *, SecurityEntry *> gkey(pc->cd, p->security);
+    GroupedParamsMap::iterator it = groups.find(gkey);
+    if(it == groups.end())
+    {
+        GroupedParamsChange gpc;
+        gpc.id = pc->id;
+        gpc.cls = p->security->cls;
+        gpc.sec = p->security->sec;
+        gpc.ts = msg.ts;
+        it = groups.insert(gkey, gpc);
+    }
+    else if(pc->id < it.value().id)
+        it.value().id = pc->id;
+    it.value().params.insert(p->param, QJsonValue::fromVariant(pval));
 }
 
-void BridgeTCPServer::secQuotesUpdate(QString cls, QString sec)
+void BridgeTCPServer::sendGroupedParams(const GroupedParamsMap &groups)
 {
-    //bool needStop = true;
-    SecSubs *s = paramSubscriptions.findSecuritySubscriptions(cls, sec);
+    GroupedParamsMap::const_iterator it;
+    for(it=groups.constBegin(); it!=groups.constEnd(); ++it)
+    {
+        const GroupedParamsChange &gpc = it.value();
+        QJsonObject grpMsg
+        {
+            {"method", "paramsChange"},
+            {"class", gpc.cls},
+            {"security", gpc.sec},
+            {"params", gpc.params}
+        };
+        if(it.key().first->timestamps && !gpc.ts.isEmpty())
+            grpMsg.insert("ts", gpc.ts);
+        it.key().first->proto->sendReq(gpc.id, grpMsg, false);
+    }
+}
+
+void BridgeTCPServer::flushParamWheel()
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QList<PendingParamSend> due = paramWheel.advance(now);
+    //отложенное значение уже не связано с одним колбеком, метка только момента отправки из колеса
+    QJsonObject stamps = stageStamps(0, monotonicNs(), 0);
+    GroupedParamsMap groups;
+    paramSubscriptions.beginRead();
+    int i;
+    for(i=0; i<due.count(); i++)
+    {
+        //подписка могла быть снята, пока значение ждало отправки
+        ParamEntry *p = paramSubscriptions.paramByKey(due.at(i).key);
+        if(!p)
+            continue;
+        ParamConsumer *pc = p->findConsumer(due.at(i).cd);
+        if(!pc || !pc->pending)
+            continue;
+        pc->pending = false;
+        NotificationBody msg(jsonBody(paramChangeMessage(p->security->cls, p->security->sec, p->param, pc->pendingValue)), stamps);
+        deliverParamChange(p, pc, pc->pendingValue, msg, groups);
+        pc->lastSentMs = now;
+        pc->lastSentValue = pc->pendingValue;
+        pc->pendingValue = QVariant();
+    }
+    sendGroupedParams(groups);
+    paramSubscriptions.endRead();
+    if(paramWheel.isEmpty())
+        paramWheelTimer->stop();
+}
+
+void BridgeTCPServer::secQuotesUpdate(QString cls, QString sec, qint64 entryNs)
+{
+    qint64 dqNs = monotonicNs();
+    SecurityEntry *s = paramSubscriptions.findSecurity(cls, sec);
     if(s)
     {
         sendStdoutLine(QString("BridgeTCPServer::secQuotesUpdate(%1, %2)").arg(cls, sec));
-        if(s->hasQuotesConsumer()) //!s->quoteConsumers.isEmpty())
+        if(!s->quoteConsumers.isEmpty())
         {
-            //needStop = false;
+            paramSubscriptions.beginRead();
+            //один вызов getQuoteLevel2 на всех подписчиков, какой бы глубины и режима они ни были
             QVariantList args, res;
             args << cls << sec;
             qqBridge->invokeMethod("getQuoteLevel2", args, res, this);
+            QJsonObject stamps = stageStamps(entryNs, dqNs, monotonicNs());
             QVariantMap mres = res[0].toMap();
-            QJsonObject subsQAns
-            {
-                {"method", "quotesChange"},
-                {"class", cls},
-                {"security", sec},
-                {"quotes", QJsonValue::fromVariant(mres)}
-            };
             int i;
-            QList<ConnectionData *> consList = s->getQuotesConsumersList(); //s->quoteConsumers.keys();
+            QList<QuoteConsumer *> consList = s->quoteConsumers;
+            bool needBook = false, sharedDelta = false;
             for(i=0; i<consList.count(); i++)
             {
-                ConnectionData *cd = consList.at(i);
-                int id = s->getQuotesSubscriptionId(cd); // s->quoteConsumers.value(cd);
-                cd->proto->sendReq(id, subsQAns, false);
+                const QuoteConsumer *qc = consList.at(i);
+                if(qc->delta || qc->depth > 0 || qc->numeric)
+                    needBook = true;
+                if(qc->delta && qc->depth <= 0)
+                    sharedDelta = true;
+            }
+            QuoteBook newBook;
+            if(needBook)
+                newBook.assign(mres, s->scale);
+            //разница полного стакана считается один раз на бумагу, общий предыдущий стакан у всех delta-подписчиков без depth
+            QJsonObject sharedDiff[2];
+            bool hasSharedDiff = false;
+            if(sharedDelta)
+            {
+                sharedDiff[0] = s->book.diff(newBook, false);
+                hasSharedDiff = !sharedDiff[0].isEmpty();
+                for(i=0; i<consList.count() && hasSharedDiff; i++)
+                {
+                    if(consList.at(i)->numeric && consList.at(i)->delta && consList.at(i)->depth <= 0)
+                    {
+                        sharedDiff[1] = s->book.diff(newBook, true);
+                        break;
+                    }
+                }
+                s->book = newBook;
+            }
+            //сообщения кешируются по (глубина, формат), чтобы одинаковые подписчики не сериализовались заново
+            QMap<int, QuoteBook> trimmedBooks;
+            QMap<int, NotificationBody> changeMsgs, snapMsgs, deltaMsgs;
+            for(i=0; i<consList.count(); i++)
+            {
+                QuoteConsumer *qc = consList.at(i);
+                if(qc->removed)
+                    continue;
+                int nf = qc->numeric ? 1 : 0;
+                int mkey = qMax(0, qc->depth) * 2 + nf;
+                if(qc->depth <= 0 && !qc->delta)
+                {
+                    if(!changeMsgs.contains(mkey))
+                        changeMsgs.insert(mkey, NotificationBody(jsonBody(qc->numeric ? quotesChangeMessage(cls, sec, newBook, s->scale) : quotesChangeMessage(cls, sec, mres)), stamps));
+                    qc->cd->proto->sendReqData(qc->id, changeMsgs[mkey].bytes(qc->cd->timestamps), false);
+                    continue;
+                }
+                if(qc->delta && qc->snapshotEvery > 0 && ++qc->sinceSnapshot >= qc->snapshotEvery)
+                    qc->needSnapshot = true;
+                if(qc->depth <= 0)
+                {
+                    if(qc->needSnapshot)
+                    {
+                        if(!snapMsgs.contains(mkey))
+                            snapMsgs.insert(mkey, NotificationBody(jsonBody(quotesSnapshotMessage(cls, sec, s->book, qc->numeric, s->scale)), stamps));
+                        qc->cd->proto->sendReqData(qc->id, snapMsgs[mkey].bytes(qc->cd->timestamps), false);
+                        qc->needSnapshot = false;
+                        qc->sinceSnapshot = 0;
+                    }
+                    else if(hasSharedDiff)
+                    {
+                        if(!deltaMsgs.contains(mkey))
+                            deltaMsgs.insert(mkey, NotificationBody(jsonBody(quotesDeltaMessage(cls, sec, sharedDiff[nf])), stamps));
+                        qc->cd->proto->sendReqData(qc->id, deltaMsgs[mkey].bytes(qc->cd->timestamps), false);
+                    }
+                    continue;
+                }
+                if(!trimmedBooks.contains(qc->depth))
+                    trimmedBooks.insert(qc->depth, newBook.trimmed(qc->depth));
+                const QuoteBook &trimmed = trimmedBooks[qc->depth];
+                if(qc->delta)
+                {
+                    if(qc->needSnapshot)
+                    {
+                        if(!snapMsgs.contains(mkey))
+                            snapMsgs.insert(mkey, NotificationBody(jsonBody(quotesSnapshotMessage(cls, sec, trimmed, qc->numeric, s->scale)), stamps));
+                        qc->cd->proto->sendReqData(qc->id, snapMsgs[mkey].bytes(qc->cd->timestamps), false);
+                        qc->needSnapshot = false;
+                        qc->sinceSnapshot = 0;
+                    }
+                    else
+                    {
+                        QJsonObject bookDiff = qc->lastBook.diff(trimmed, qc->numeric);
+                        if(!bookDiff.isEmpty())
+                        {
+                            QJsonObject deltaMsg = quotesDeltaMessage(cls, sec, bookDiff);
+                            if(qc->cd->timestamps && !stamps.isEmpty())
+                                deltaMsg.insert("ts", stamps);
+                            qc->cd->proto->sendReq(qc->id, deltaMsg, false);
+                        }
+                    }
+                }
+                else
+                {
+                    //в пределах запрошенной глубины ничего не поменялось
+                    if(qc->lastBook.isValid() && qc->lastBook == trimmed)
+                        continue;
+                    if(!changeMsgs.contains(mkey))
+                        changeMsgs.insert(mkey, NotificationBody(jsonBody(qc->numeric ? quotesChangeMessage(cls, sec, trimmed, s->scale) : quotesChangeMessage(cls, sec, trimLevel2(mres, qc->depth))), stamps));
+                    qc->cd->proto->sendReqData(qc->id, changeMsgs[mkey].bytes(qc->cd->timestamps), false);
+                }
+                qc->lastBook = trimmed;
             }
+            paramSubscriptions.endRead();
         }
         else
         {
@@ -1059,585 +2636,455 @@ void BridgeTCPServer::secQuotesUpdate(QString cls, QString sec)
     */
 }
 
-FastCallbackRequestEventLoop::FastCallbackRequestEventLoop(ConnectionData *rcd, int oid, QString rfname, BridgeTCPServer *s)
-    : cd(rcd), funName(rfname), objId(oid), waitMux(nullptr), srv(s)
-{
-}
-
-QVariant FastCallbackRequestEventLoop::sendAndWaitResult(BridgeTCPServer *server, const QVariantList &args)
-{
-    QMutex waitMutex;
-    waitMux = &waitMutex;
-    cd->fcbWaitResult = this;
-    sendStdoutLine(QString("sendAndWaitResult: invoke fastCallbackRequestHandler..."));
-    QMetaObject::invokeMethod(server, "fastCallbackRequestHandler", Qt::QueuedConnection,
-                              Q_ARG(ConnectionData*, cd),
-                              Q_ARG(int, objId),
-                              Q_ARG(QString, funName),
-                              Q_ARG(QVariantList, args));
-    sendStdoutLine(QString("sendAndWaitResult: wait result..."));
-    waitMutex.lock();
-    waitMutex.tryLock(FASTCALLBACK_TIMEOUT_SEC * 1000);
-    sendStdoutLine(QString("sendAndWaitResult: Event loop finished"));
-    waitMux = nullptr;
-    waitMutex.unlock();
-    if(cd)
-        cd->fcbWaitResult = nullptr;
-    return result;
-}
-
-void FastCallbackRequestEventLoop::fastCallbackRequestSent(ConnectionData *acd, int oid, QString afname, int aid)
-{
-    if(cd==acd && funName==afname && objId==oid)
-    {
-        sendStdoutLine(QString("Fast callback request sent"));
-        id = aid;
-    }
-}
-
-void FastCallbackRequestEventLoop::fastCallbackReturnArrived(ConnectionData *acd, int aid, QVariant res)
+void BridgeTCPServer::processSecurityUpdates()
 {
-    if(cd==acd && id==aid)
+    QList<SecurityUpdateQueue::Item> items = updateQueue.takeAll();
+    int i;
+    for(i=0; i<items.count(); i++)
     {
-        result = res;
-        sendStdoutLine(QString("Wake fast callback waiter"));
-        if(waitMux)
-            waitMux->unlock();
-        else
-        {
-            sendStderrLine(QString("Fast callback return arrived without locking?"));
-        }
+        const SecurityUpdateQueue::Item &item = items.at(i);
+        if(item.kinds & SecurityUpdateQueue::ParamsUpdate)
+            secParamsUpdate(item.cls, item.sec, item.entryNs[0]);
+        if(item.kinds & SecurityUpdateQueue::QuotesUpdate)
+            secQuotesUpdate(item.cls, item.sec, item.entryNs[1]);
     }
 }
 
-void FastCallbackRequestEventLoop::connectionDataDeleted(ConnectionData *dcd)
+void BridgeTCPServer::invalidateReferenceData()
 {
-    if(cd == dcd)
+    sendStdoutLine("Reference data cache invalidated");
+    refData.invalidate();
+    //после переподключения или очистки терминала снимку верим только после сверки хешей
+    refSnapshot.distrustAll();
+    if(!refDataPreload.isEmpty())
     {
-        cd = nullptr;
-        if(waitMux)
-        {
-            waitMux->unlock();
-            sendStdoutLine(QString("Wake fast callback waiter(connectionDataDeleted)"));
-        }
-        else
-        {
-            sendStderrLine(QString("Connection data deleted unexpected call"));
-        }
+        bool idle = refDataPreloadQueue.isEmpty();
+        refDataPreloadQueue = refDataPreload;
+        if(idle)
+            QTimer::singleShot(0, this, SLOT(preloadReferenceData()));
     }
 }
 
-ConnectionData::~ConnectionData()
+void BridgeTCPServer::preloadReferenceData()
 {
-    while(!objRefs.isEmpty())
+    //по одному классу за заход в цикл событий, чтобы запросы клиентов шли вперемешку с прогревом
+    if(refDataPreloadQueue.isEmpty())
+        return;
+    QString cls = refDataPreloadQueue.takeFirst();
+    if(cls == "*")
     {
-        int objid = objRefs.takeLast();
-        qqBridge->deleteObject(objid);
-        sendStdoutLine(QString("Object %1 deleted").arg(objid));
+        refDataPreloadQueue = secClasses();
     }
-    if(fcbWaitResult)
-        fcbWaitResult->connectionDataDeleted(this);
-    if(proto)
-        delete proto;
-}
-
-ParamSubscriptionsDb::ParamSubscriptionsDb()
-{
-
-}
-
-ParamSubscriptionsDb::~ParamSubscriptionsDb()
-{
-    //Здесь нельзя использовать локер использующий стек,
-    //потому-что он удаляется вместе с мьютексом на выходе из деструктора
-    // sendStdoutLine("ParamSubscriptionsDb::~ParamSubscriptionsDb lock");
-    mutex.lock();
-    QStringList keys = classes.keys();
-    foreach (QString cls, keys)
+    else
     {
-        delete classes.take(cls);
+        QList<QVariantMap> rows;
+        if(loadClassSecurities(cls, rows))
+            sendStdoutLine(QString("Reference data for class %1 preloaded: %2 securities").arg(cls).arg(rows.count()));
     }
-    mutex.unlock();
-    // sendStdoutLine("ParamSubscriptionsDb::~ParamSubscriptionsDb unlocked");
+    if(!refDataPreloadQueue.isEmpty())
+        QTimer::singleShot(0, this, SLOT(preloadReferenceData()));
 }
 
-void ParamSubscriptionsDb::addConsumer(ConnectionData *cd, QString cls, QString sec, QString param, int id)
+void BridgeTCPServer::verifyReferenceSnapshot()
 {
-    sendStdoutLine(QString("ParamSubscriptionsDb::addConsumer(%1, %2, %3, %4)").arg(cls, sec, param).arg(id));
-    ClsSubs *c;
-    mutex.lock();
+    //по одному классу за заход в цикл событий, как и прогрев
+    if(refSnapshotCheckQueue.isEmpty())
+        return;
+    QString cls = refSnapshotCheckQueue.takeFirst();
+    QVariantList args, res;
+    if(cls.isEmpty())
     {
-        if(classes.contains(cls))
-        {
-            sendStdoutLine("ParamSubscriptionsDb::addConsumer: class already exists");
-            c = classes.value(cls);
-        }
-        else
+        qqBridge->invokeMethod("getClassesList", args, res, this);
+        QByteArray hash = ReferenceDataSnapshot::listHash(res[0].toString());
+        if(hash != refSnapshot.classesHash())
         {
-            sendStdoutLine("ParamSubscriptionsDb::addConsumer: create new class");
-            c = new ClsSubs(cls);
-            classes.insert(cls, c);
+            QStringList classes = res[0].toString().split(",", Qt::SkipEmptyParts);
+            refData.setClasses(classes);
+            refSnapshot.setClasses(classes, hash);
+            foreach (QString stored, refSnapshot.storedClasses())
+            {
+                if(!classes.contains(stored))
+                {
+                    refSnapshot.removeClass(stored);
+                    refData.invalidateClass(stored);
+                    refSnapshotCheckQueue.removeOne(stored);
+                }
+            }
+            sendStdoutLine(QString("Reference data snapshot: class list changed, %1 classes").arg(classes.count()));
         }
     }
-    mutex.unlock();
-    // sendStdoutLine(QString("ParamSubscriptionsDb::addConsumer(%1, %2, %3, %4): addConsumer to class").arg(cls, sec, param).arg(id));
-    c->addConsumer(cd, sec, param, id);
-}
-
-bool ParamSubscriptionsDb::delConsumer(ConnectionData *cd, QString cls, QString sec, QString param)
-{
-    sendStdoutLine(QString("ParamSubscriptionsDb::delConsumer(%1, %2, %3)").arg(cls, sec, param));
-    mutex.lock();
-    if(classes.contains(cls))
-    {
-        sendStdoutLine(QString("ParamSubscriptionsDb::delConsumer found class %1 in subscriptions").arg(cls));
-        if(classes.value(cls)->delConsumer(cd, sec, param))
-            delete classes.take(cls);
-    }
-    bool res = classes.isEmpty();
-    mutex.unlock();
-    // sendStdoutLine(QString("ParamSubscriptionsDb::delConsumer(%1, %2, %3) unlocked").arg(cls, sec, param));
-    return res;
-}
-
-bool ParamSubscriptionsDb::clearAllSubscriptions(ConnectionData *cd)
-{
-    // sendStdoutLine(QString("ParamSubscriptionsDb::clearAllSubscriptions() lock"));
-    mutex.lock();
-    QStringList toDel = classes.keys();
-    foreach (QString cname, toDel)
+    else if(refSnapshot.isTrusted(cls))
     {
-        ClsSubs *c = classes[cname];
-        if(c->clearAllSubscriptions(cd))
+        //классы, которые уже перечитаны или сверены по запросу клиента, пропускаются
+        refSnapshot.distrust(cls);
+        args << cls;
+        qqBridge->invokeMethod("getClassSecurities", args, res, this);
+        if(ReferenceDataSnapshot::listHash(res[0].toString()) != refSnapshot.classSecuritiesHash(cls))
         {
-            classes.remove(cname);
-            delete c;
+            refSnapshot.removeClass(cls);
+            refData.invalidateClass(cls);
+            QList<QVariantMap> rows;
+            if(loadClassSecurities(cls, rows))
+                sendStdoutLine(QString("Reference data snapshot: class %1 changed, %2 securities reloaded").arg(cls).arg(rows.count()));
         }
     }
-    bool res = classes.isEmpty();
-    mutex.unlock();
-    // sendStdoutLine(QString("ParamSubscriptionsDb::clearAllSubscriptions() unlocked"));
-    return res;
+    if(!refSnapshotCheckQueue.isEmpty())
+        QTimer::singleShot(0, this, SLOT(verifyReferenceSnapshot()));
+    else if(refSnapshot.isDirty())
+        scheduleReferenceSnapshotSave();
 }
 
-ParamSubs *ParamSubscriptionsDb::findParamSubscriptions(QString cls, QString sec, QString param)
+void BridgeTCPServer::scheduleReferenceSnapshotSave()
 {
-    ParamSubs *res = nullptr;
-    // sendStdoutLine("ParamSubscriptionsDb::findParamSubscriptions lock");
-    mutex.lock();
-    if(classes.contains(cls))
-        res = classes.value(cls)->findParamSubscriptions(sec, param);
-    mutex.unlock();
-    // sendStdoutLine("ParamSubscriptionsDb::findParamSubscriptions unlocked");
-    return res;
+    //изменения копятся несколько секунд, чтобы прогрев всех классов не переписывал файл на каждом
+    if(refSnapshotSavePending)
+        return;
+    refSnapshotSavePending = true;
+    QTimer::singleShot(5000, this, SLOT(saveReferenceSnapshot()));
 }
 
-SecSubs *ParamSubscriptionsDb::findSecuritySubscriptions(QString cls, QString sec)
+void BridgeTCPServer::saveReferenceSnapshot()
 {
-    SecSubs *res = nullptr;
-    // sendStdoutLine("ParamSubscriptionsDb::findSecuritySubscriptions lock");
-    mutex.lock();
-    if(classes.contains(cls))
-        res = classes.value(cls)->findSecuritySubscriptions(sec);
-    mutex.unlock();
-    // sendStdoutLine("ParamSubscriptionsDb::findSecuritySubscriptions unlocked");
-    return res;
+    refSnapshotSavePending = false;
+    if(!refSnapshot.isDirty())
+        return;
+    if(refSnapshot.save())
+        sendStdoutLine(QString("Reference data snapshot saved: securities of %1 classes").arg(refSnapshot.classesCount()));
+    else
+        sendStderrLine("Reference data snapshot could not be saved");
 }
 
-void ParamSubscriptionsDb::addQuotesConsumer(ConnectionData *cd, QString cls, QString sec, int id)
+void BridgeTCPServer::applyMirrorUpdate(QString name, QVariantMap row)
 {
-    sendStdoutLine(QString("ParamSubscriptionsDb::addQuotesConsumer(%1, %2, %3)").arg(cls, sec).arg(id));
-    ClsSubs *c;
-    mutex.lock();
-    {
-        if(classes.contains(cls))
+    const TableMirrorSpec *spec = TableMirror::findSpecByCallback(name);
+    TableMirror *m = spec ? mirrors.value(spec->table, nullptr) : nullptr;
+    if(!m)
+        return;
+    int rowId;
+    QVariantMap oldRow;
+    bool remove = (name == m->deleteCallback());
+    TableMirror::Change ch = m->apply(row, remove, rowId, &oldRow);
+    if(ch == TableMirror::NoChange)
+        return;
+    //удалённая строка в зеркале уже очищена, подписчикам уходит её последнее содержимое
+    const QVariantMap &cur = (ch == TableMirror::Deleted) ? oldRow : m->row(rowId);
+    //тело без проекции сериализуется один раз на операцию
+    QMap<QString, QByteArray> bodies;
+    int i;
+    for(i=0; i<mirrorSubscriptions.count(); i++)
+    {
+        const MirrorSubscription &ms = mirrorSubscriptions.at(i);
+        if(ms.table != m->table())
+            continue;
+        //подписчик видит свою отфильтрованную выборку: строка может в неё войти или из неё выйти
+        bool oldMatch = (ch != TableMirror::Inserted) && ms.flt.match(ch == TableMirror::Deleted ? cur : oldRow);
+        bool newMatch = (ch != TableMirror::Deleted) && ms.flt.match(cur);
+        QString op;
+        if(newMatch)
+            op = oldMatch ? "update" : "insert";
+        else if(oldMatch)
+            op = "delete";
+        else
+            continue;
+        if(ms.fields.isEmpty() && bodies.contains(op))
         {
-            sendStdoutLine("ParamSubscriptionsDb::addQuotesConsumer: class already exists");
-            c = classes.value(cls);
+            ms.cd->proto->sendReqData(ms.id, bodies.value(op), false);
+            continue;
         }
+        QJsonObject jrow;
+        if(ms.fields.isEmpty())
+            jrow = QJsonObject::fromVariantMap(cur);
         else
         {
-            sendStdoutLine("ParamSubscriptionsDb::addQuotesConsumer: create new class");
-            c = new ClsSubs(cls);
-            classes.insert(cls, c);
+            foreach (QString fname, ms.fields)
+            {
+                if(cur.contains(fname))
+                    jrow.insert(fname, QJsonValue::fromVariant(cur.value(fname)));
+            }
         }
+        QJsonObject chMsg
+        {
+            {"method", "mirrorChange"},
+            {"table", m->table()},
+            {"op", op},
+            {"row", jrow}
+        };
+        QByteArray body = jsonBody(chMsg);
+        if(ms.fields.isEmpty())
+            bodies.insert(op, body);
+        ms.cd->proto->sendReqData(ms.id, body, false);
     }
-    mutex.unlock();
-    // sendStdoutLine("ParamSubscriptionsDb::addQuotesConsumer unlocked");
-    c->addQuotesConsumer(cd, sec, id);
-}
-
-bool ParamSubscriptionsDb::delQuotesConsumer(ConnectionData *cd, QString cls, QString sec)
-{
-    // sendStdoutLine("ParamSubscriptionsDb::delQuotesConsumer lock");
-    mutex.lock();
-    if(classes.contains(cls))
-    {
-        if(classes.value(cls)->delQuotesConsumer(cd, sec))
-            delete classes.take(cls);
-    }
-    bool res = classes.isEmpty();
-    mutex.unlock();
-    // sendStdoutLine("ParamSubscriptionsDb::delQuotesConsumer unlocked");
-    return res;
-}
-
-ClsSubs::~ClsSubs()
-{
-    //Здесь нельзя использовать локер использующий стек,
-    //потому-что он удаляется вместе с мьютексом на выходе из деструктора
-    // sendStdoutLine("ClsSubs::~ClsSubs lock");
-    mutex.lock();
-    QStringList keys = securities.keys();
-    foreach (QString sec, keys)
-    {
-        delete securities.take(sec);
-    }
-    mutex.unlock();
-    // sendStdoutLine("ClsSubs::~ClsSubs unlocked");
 }
 
-void ClsSubs::addConsumer(ConnectionData *cd, QString sec, QString param, int id)
+void BridgeTCPServer::continueRowStreams()
 {
-    sendStdoutLine(QString("ClsSubs#%1::addConsumer(%2, %3, %4)").arg(this->className, sec, param).arg(id));
-    SecSubs *s;
-    mutex.lock();
+    //по одной порции на поток за заход в цикл событий: большие выборки не задерживают
+    //другие запросы и уведомления, а память держит только текущая порция
+    QList<RowsQuery *> streams = rowStreams;
+    int i;
+    for(i=0; i<streams.count(); i++)
     {
-        if(securities.contains(sec))
+        RowsQuery *q = streams.at(i);
+        QJsonArray table;
+        bool more = q->next(q->chunk, table);
+        QJsonObject chunkRes
         {
-            sendStdoutLine("ParamSubscriptionsDb::addConsumer: security already exists");
-            s = securities.value(sec);
-        }
-        else
+            {"method", "return"},
+            {"result", table},
+            {"more", more}
+        };
+        q->cd->proto->sendAns(q->id, chunkRes, false);
+        if(!more)
         {
-            sendStdoutLine("ParamSubscriptionsDb::addConsumer: create new security");
-            s = new SecSubs(sec);
-            securities.insert(sec, s);
+            rowStreams.removeOne(q);
+            delete q;
         }
     }
-    mutex.unlock();
-    // sendStdoutLine("ClsSubs::addConsumer unlocked");
-    s->addConsumer(cd, param, id);
+    if(!rowStreams.isEmpty())
+        QTimer::singleShot(0, this, SLOT(continueRowStreams()));
 }
 
-bool ClsSubs::delConsumer(ConnectionData *cd, QString sec, QString param)
+void BridgeTCPServer::continueParamSnapshots()
 {
-    // sendStdoutLine("ClsSubs::delConsumer lock");
-    mutex.lock();
-    if(securities.contains(sec))
+    int i;
+    for(i=paramSnapshots.count()-1; i>=0; i--)
     {
-        sendStdoutLine(QString("ClsSubs::delConsumer found security %1 in subscriptions").arg(sec));
-        if(securities.value(sec)->delConsumer(cd, param))
-            delete securities.take(sec);
+        if(!sendParamsSnapshotChunk(paramSnapshots[i]))
+            paramSnapshots.removeAt(i);
     }
-    bool res = securities.isEmpty();
-    mutex.unlock();
-    // sendStdoutLine("ClsSubs::delConsumer unlocked");
-    return res;
+    if(!paramSnapshots.isEmpty())
+        QTimer::singleShot(0, this, SLOT(continueParamSnapshots()));
 }
 
-bool ClsSubs::clearAllSubscriptions(ConnectionData *cd)
+void BridgeTCPServer::flushJournal()
 {
-    // sendStdoutLine("ClsSubs::clearAllSubscriptions lock");
-    mutex.lock();
-    QStringList toDel = securities.keys();
-    foreach (QString sname, toDel)
-    {
-        SecSubs *s = securities[sname];
-        if(s->clearAllSubscriptions(cd))
-        {
-            securities.remove(sname);
-            delete s;
-        }
-    }
-    bool res = securities.isEmpty();
-    mutex.unlock();
-    // sendStdoutLine("ClsSubs::clearAllSubscriptions unlocked");
-    return res;
+    journal.flushSpill();
 }
 
-ParamSubs *ClsSubs::findParamSubscriptions(QString sec, QString param)
+void BridgeTCPServer::releaseBarSeries(QString key)
 {
-    ParamSubs *res = nullptr;
-    // sendStdoutLine("ClsSubs::findParamSubscriptions lock");
-    mutex.lock();
-    if(securities.contains(sec))
-        res = securities.value(sec)->findParamSubscriptions(param);
-    mutex.unlock();
-    // sendStdoutLine("ClsSubs::findParamSubscriptions unlocked");
-    return res;
+    BarSeries *s = barSeries.value(key, nullptr);
+    if(!s || s->subscribers() > 0)
+        return;
+    int i;
+    for(i=0; i<pendingBarsRequests.count(); i++)
+    {
+        if(pendingBarsRequests.at(i).key == key)
+            return;
+    }
+    closeBarSeries(s);
 }
 
-SecSubs *ClsSubs::findSecuritySubscriptions(QString sec)
+void BridgeTCPServer::closeBarSeries(BarSeries *s)
 {
-    SecSubs *res = nullptr;
-    // sendStdoutLine("ClsSubs::findSecuritySubscriptions lock");
-    mutex.lock();
-    if(securities.contains(sec))
-        res = securities.value(sec);
-    mutex.unlock();
-    // sendStdoutLine("ClsSubs::findSecuritySubscriptions unlocked");
-    return res;
+    QVariantList args, res;
+    qqBridge->invokeObjectMethod(s->objectId(), "Close", args, res, this);
+    qqBridge->deleteObject(s->objectId());
+    barSeries.remove(s->key());
+    sendStdoutLine(QString("Data source %1 %2 %3 closed").arg(s->classCode()).arg(s->securityCode()).arg(s->interval()));
+    delete s;
 }
 
-void ClsSubs::addQuotesConsumer(ConnectionData *cd, QString sec, int id)
+void BridgeTCPServer::answerPendingBarsRequests()
 {
-    sendStdoutLine(QString("ClsSubs#%1::addQuotesConsumer(%2, %3)").arg(this->className, sec).arg(id));
-    SecSubs *s;
-    mutex.lock();
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    int i;
+    for(i=0; i<pendingBarsRequests.count(); )
     {
-        if(securities.contains(sec))
+        if(pendingBarsRequests.at(i).due > now)
         {
-            sendStdoutLine("ClsSubs::addQuotesConsumer: security already exists");
-            s = securities.value(sec);
-        }
-        else
-        {
-            sendStdoutLine("ClsSubs::addQuotesConsumer: create new security");
-            s = new SecSubs(sec);
-            securities.insert(sec, s);
+            i++;
+            continue;
         }
+        PendingBarsRequest pr = pendingBarsRequests.takeAt(i);
+        BarSeries *s = barSeries.value(pr.key, nullptr);
+        if(s && m_connections.contains(pr.cd))
+            answerBarsRequest(pr.cd, pr.id, s, pr.req);
     }
-    mutex.unlock();
-    // sendStdoutLine("ClsSubs::addQuotesConsumer unlocked");
-    s->addQuotesConsumer(cd, id);
 }
 
-bool ClsSubs::delQuotesConsumer(ConnectionData *cd, QString sec)
+void BridgeTCPServer::closeIdleBarSeries()
 {
-    // sendStdoutLine("ClsSubs::delQuotesConsumer lock");
-    mutex.lock();
-    if(securities.contains(sec))
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QStringList idle;
+    foreach (BarSeries *s, barSeries)
     {
-        if(securities.value(sec)->delQuotesConsumer(cd))
-            delete securities.take(sec);
+        if(s->subscribers() == 0 && now - s->lastUsed() >= BARS_IDLE_CLOSE_MS)
+            idle.append(s->key());
     }
-    bool res = securities.isEmpty();
-    mutex.unlock();
-    // sendStdoutLine("ClsSubs::delQuotesConsumer unlocked");
-    return res;
+    foreach (QString key, idle)
+        releaseBarSeries(key);
 }
 
-SecSubs::~SecSubs()
+void BridgeTCPServer::scheduleBarsUpdate(int intervalMs)
 {
-    //Здесь нельзя использовать локер использующий стек,
-    //потому-что он удаляется вместе с мьютексом на выходе из деструктора
-    // sendStdoutLine("SecSubs::~SecSubs lock");
-    pmutex.lock();
-    QStringList keys = params.keys();
-    foreach (QString par, keys)
-    {
-        delete params.take(par);
-    }
-    pmutex.unlock();
-    // sendStdoutLine("SecSubs::~SecSubs unlocked");
+    QTimer::singleShot(intervalMs, this, SLOT(flushBarsUpdates()));
 }
 
-void SecSubs::addConsumer(ConnectionData *cd, QString param, int id)
+void BridgeTCPServer::flushBarsUpdates()
 {
-    sendStdoutLine(QString("SecSubs#%1::addConsumer(%2, %3)").arg(this->secName, param).arg(id));
-    ParamSubs *p;
-    pmutex.lock();
+    QList<PendingBarsUpdate> ready;
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 nextDue = -1;
+    barsMutex.lock();
+    QMap<void *, PendingBarsUpdate>::iterator it = pendingBars.begin();
+    while(it != pendingBars.end())
     {
-        if(params.contains(param))
+        if(it.value().due <= now)
         {
-            sendStdoutLine("ParamSubscriptionsDb::addConsumer: param already exists");
-            p = params.value(param);
+            ready.append(it.value());
+            it = pendingBars.erase(it);
         }
         else
         {
-            sendStdoutLine("ParamSubscriptionsDb::addConsumer: create new param");
-            p = new ParamSubs(param);
-            params.insert(param, p);
+            if(nextDue < 0 || it.value().due < nextDue)
+                nextDue = it.value().due;
+            ++it;
         }
     }
-    pmutex.unlock();
-    // sendStdoutLine("SecSubs::addConsumer unlocked");
-    p->addConsumer(cd, id);
-}
-
-bool SecSubs::delConsumer(ConnectionData *cd, QString param)
-{
-    // sendStdoutLine("SecSubs::delConsumer lock");
-    pmutex.lock();
-    if(params.contains(param))
+    barsMutex.unlock();
+    if(nextDue >= 0)
+        scheduleBarsUpdate((int)(nextDue - now));
+    int i;
+    for(i=0; i<ready.count(); i++)
     {
-        sendStdoutLine(QString("SecSubs::delConsumer found param %1 in subscriptions").arg(param));
-        if(params.value(param)->delConsumer(cd))
-            delete params.take(param);
+        const PendingBarsUpdate &pbu = ready.at(i);
+        if(!pbu.seriesKey.isEmpty())
+        {
+            updateBarSeries(pbu.seriesKey, pbu.from, pbu.to);
+            continue;
+        }
+        if(!m_connections.contains(pbu.cd))
+            continue;
+        //источник мог оказаться короче накопленного диапазона: from/to - реально прочитанные свечи
+        int to = pbu.to;
+        QJsonArray bars = readBars(pbu.objId, pbu.from, to);
+        if(bars.isEmpty())
+            continue;
+        QJsonObject barsMsg
+        {
+            {"method", "barsUpdate"},
+            {"object", pbu.objId},
+            {"function", pbu.funName},
+            {"from", pbu.from},
+            {"to", to},
+            {"bars", bars}
+        };
+        safeSendReq(pbu.cd, pbu.reqId, barsMsg, false);
     }
-    qmutex.lock();
-    bool res = (params.isEmpty() && quoteConsumers.isEmpty());
-    qmutex.unlock();
-    pmutex.unlock();
-    // sendStdoutLine("SecSubs::delConsumer unlocked");
-    return res;
 }
 
-bool SecSubs::clearAllSubscriptions(ConnectionData *cd)
+QJsonArray BridgeTCPServer::readBars(int objId, int from, int &to)
 {
-    // sendStdoutLine("SecSubs::clearAllSubscriptions lock");
-    pmutex.lock();
-    QStringList toDel;
-    foreach (ParamSubs *p, params)
+    QJsonArray bars;
+    QStringList methods;
+    int i, j;
+    for(j=0; j<BarSeries::ColumnsCount; j++)
+        methods.append(BarSeries::columnMethod(j));
+    //все свечи диапазона читаются одним проходом в луа
+    QList<QVariantList> columns;
+    if(!qqBridge->invokeObjectMethodRange(objId, methods, from, to, 0, columns, this))
     {
-        if(p->delConsumer(cd))
-            toDel.append(p->param);
+        to = from - 1;
+        return bars;
     }
-    while (!toDel.isEmpty())
+    int n = columns.value(0).count();
+    to = from + n - 1;
+    for(i=0; i<n; i++)
     {
-        QString pname = toDel.takeFirst();
-        delete params.take(pname);
+        QJsonObject bar
+        {
+            {"index", from + i}
+        };
+        for(j=0; j<columns.count(); j++)
+            bar.insert(BarSeries::columnName(j), QJsonValue::fromVariant(columns.at(j).value(i)));
+        bars.append(bar);
     }
-    qmutex.lock();
-    quoteConsumers.remove(cd);
-    bool res = (params.isEmpty() && quoteConsumers.isEmpty());
-    qmutex.unlock();
-    pmutex.unlock();
-    // sendStdoutLine("SecSubs::clearAllSubscriptions unlocked");
-    return res;
+    return bars;
 }
 
-ParamSubs *SecSubs::findParamSubscriptions(QString param)
-{
-    ParamSubs *res = nullptr;
-    // sendStdoutLine("SecSubs::findParamSubscriptions lock");
-    pmutex.lock();
-    if(params.contains(param))
-        res = params.value(param);
-    pmutex.unlock();
-    // sendStdoutLine("SecSubs::findParamSubscriptions unlocked");
-    return res;
-}
-
-void SecSubs::addQuotesConsumer(ConnectionData *cd, int id)
-{
-    sendStdoutLine(QString("SecSubs#%1::addQuotesConsumer(%2)").arg(this->secName).arg(id));
-    qmutex.lock();
-    if(!quoteConsumers.contains(cd))
-        quoteConsumers.insert(cd, id);
-    qmutex.unlock();
-    // sendStdoutLine("SecSubs::addQuotesConsumer unlocked");
-}
-
-bool SecSubs::delQuotesConsumer(ConnectionData *cd)
+FastCallbackRequestEventLoop::FastCallbackRequestEventLoop(ConnectionData *rcd, int oid, QString rfname, BridgeTCPServer *s)
+    : cd(rcd), funName(rfname), objId(oid), waitMux(nullptr), srv(s)
 {
-    sendStdoutLine(QString("SecSubs#%1::delQuotesConsumer()").arg(this->secName));
-    qmutex.lock();
-    quoteConsumers.remove(cd);
-    pmutex.lock();
-    bool res = (params.isEmpty() && quoteConsumers.isEmpty());
-    pmutex.unlock();
-    qmutex.unlock();
-    // sendStdoutLine("SecSubs::delQuotesConsumer unlocked");
-    return res;
 }
 
-bool SecSubs::hasQuotesConsumer(ConnectionData *cd)
+QVariant FastCallbackRequestEventLoop::sendAndWaitResult(BridgeTCPServer *server, const QVariantList &args)
 {
-    // sendStdoutLine("SecSubs::hasQuotesConsumer lock");
-    qmutex.lock();
-    bool res;
+    QMutex waitMutex;
+    waitMux = &waitMutex;
+    cd->fcbWaitResult = this;
+    sendStdoutLine(QString("sendAndWaitResult: invoke fastCallbackRequestHandler..."));
+    QMetaObject::invokeMethod(server, "fastCallbackRequestHandler", Qt::QueuedConnection,
+                              Q_ARG(ConnectionData*, cd),
+                              Q_ARG(int, objId),
+                              Q_ARG(QString, funName),
+                              Q_ARG(QVariantList, args));
+    sendStdoutLine(QString("sendAndWaitResult: wait result..."));
+    waitMutex.lock();
+    waitMutex.tryLock(FASTCALLBACK_TIMEOUT_SEC * 1000);
+    sendStdoutLine(QString("sendAndWaitResult: Event loop finished"));
+    waitMux = nullptr;
+    waitMutex.unlock();
     if(cd)
-        res = quoteConsumers.contains(cd);
-    else
-        res = !quoteConsumers.isEmpty();
-    qmutex.unlock();
-    // sendStdoutLine("SecSubs::hasQuotesConsumer unlocked");
-    return res;
-}
-
-QStringList SecSubs::getParamsList()
-{
-    QStringList res;
-    // sendStdoutLine("SecSubs::getParamsList lock");
-    pmutex.lock();
-    res = params.keys();
-    pmutex.unlock();
-    // sendStdoutLine("SecSubs::getParamsList unlocked");
-    return res;
-}
-
-QList<ConnectionData *> SecSubs::getQuotesConsumersList()
-{
-    QList<ConnectionData *> res;
-    // sendStdoutLine("SecSubs::getQuotesConsumersList lock");
-    qmutex.lock();
-    res = quoteConsumers.keys();
-    qmutex.unlock();
-    // sendStdoutLine("SecSubs::getQuotesConsumersList unlocked");
-    return res;
-}
-
-int SecSubs::getQuotesSubscriptionId(ConnectionData *cd)
-{
-    int res = -1;
-    // sendStdoutLine("SecSubs::getQuotesSubscriptionId lock");
-    qmutex.lock();
-    if(quoteConsumers.contains(cd))
-        res = quoteConsumers.value(cd);
-    qmutex.unlock();
-    // sendStdoutLine("SecSubs::getQuotesSubscriptionId unlocked");
-    return res;
-}
-
-void ParamSubs::addConsumer(ConnectionData *cd, int id)
-{
-    // sendStdoutLine(QString("ParamSubs#%1::addConsumer(%2)").arg(this->param).arg(id));
-    mutex.lock();
-    if(!consumers.contains(cd))
-        consumers.insert(cd, id);
-    mutex.unlock();
-    // sendStdoutLine("ParamSubs::addConsumer unlocked");
+        cd->fcbWaitResult = nullptr;
+    return result;
 }
 
-bool ParamSubs::delConsumer(ConnectionData *cd)
+void FastCallbackRequestEventLoop::fastCallbackRequestSent(ConnectionData *acd, int oid, QString afname, int aid)
 {
-    if(!cd)
-        return true;
-    sendStdoutLine(QString("ParamSubs#%1::delConsumer()").arg(this->param));
-    mutex.lock();
-    consumers.remove(cd);
-    bool res = consumers.isEmpty();
-    mutex.unlock();
-    // sendStdoutLine("ParamSubs::delConsumer unlocked");
-    return res;
+    if(cd==acd && funName==afname && objId==oid)
+    {
+        sendStdoutLine(QString("Fast callback request sent"));
+        id = aid;
+    }
 }
 
-bool ParamSubs::hasConsumer(ConnectionData *cd)
+void FastCallbackRequestEventLoop::fastCallbackReturnArrived(ConnectionData *acd, int aid, QVariant res)
 {
-    // sendStdoutLine("ParamSubs::hasConsumer lock");
-    mutex.lock();
-    bool res = consumers.contains(cd);
-    mutex.unlock();
-    // sendStdoutLine("ParamSubs::hasConsumer unlocked");
-    return res;
+    if(cd==acd && id==aid)
+    {
+        result = res;
+        sendStdoutLine(QString("Wake fast callback waiter"));
+        if(waitMux)
+            waitMux->unlock();
+        else
+        {
+            sendStderrLine(QString("Fast callback return arrived without locking?"));
+        }
+    }
 }
 
-QList<ConnectionData *> ParamSubs::consumersList()
+void FastCallbackRequestEventLoop::connectionDataDeleted(ConnectionData *dcd)
 {
-    QList<ConnectionData *> res;
-    // sendStdoutLine("ParamSubs::consumersList lock");
-    mutex.lock();
-    res = consumers.keys();
-    mutex.unlock();
-    // sendStdoutLine("ParamSubs::consumersList unlocked");
-    return res;
+    if(cd == dcd)
+    {
+        cd = nullptr;
+        if(waitMux)
+        {
+            waitMux->unlock();
+            sendStdoutLine(QString("Wake fast callback waiter(connectionDataDeleted)"));
+        }
+        else
+        {
+            sendStderrLine(QString("Connection data deleted unexpected call"));
+        }
+    }
 }
 
-int ParamSubs::getSubscriptionId(ConnectionData *cd)
+ConnectionData::~ConnectionData()
 {
-    int res = -1;
-    // sendStdoutLine("ParamSubs::getSubscriptionId lock");
-    mutex.lock();
-    if(consumers.contains(cd))
-        res = consumers.value(cd);
-    mutex.unlock();
-    // sendStdoutLine("ParamSubs::getSubscriptionId unlocked");
-    return res;
+    while(!objRefs.isEmpty())
+    {
+        int objid = objRefs.takeLast();
+        qqBridge->deleteObject(objid);
+        sendStdoutLine(QString("Object %1 deleted").arg(objid));
+    }
+    if(fcbWaitResult)
+        fcbWaitResult->connectionDataDeleted(this);
+    if(proto)
+        delete proto;
 }
 
-
 void sendStdoutLine(QString line)
 {
     BridgeTCPServer *gsrv = BridgeTCPServer::getGlobalServer();
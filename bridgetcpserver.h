@@ -11,8 +11,20 @@
 #include <QTextStream>
 #include <QMutex>
 #include <QWaitCondition>
+#include <QTimer>
+#include <QAtomicInteger>
 #include "jsonprotocolhandler.h"
 #include "quikqtbridge.h"
+#include "callbackjournal.h"
+#include "securityupdatequeue.h"
+#include "subscriptionindex.h"
+#include "timerwheel.h"
+#include "eventclock.h"
+#include "referencedatacache.h"
+#include "referencedatasnapshot.h"
+#include "rowfilter.h"
+#include "tablemirror.h"
+#include "barseries.h"
 
 #define BRIDGE_SERVER_PROTOCOL_VERSION  1
 #define FASTCALLBACK_TIMEOUT_SEC    5
@@ -25,90 +37,129 @@ struct ConnectionData
     QString peerIp;
     JsonProtocolHandler *proto;
     QMap<QString, int> callbackSubscriptions;
+    QMap<QString, CallbackFilter> callbackFilters;
     int peerProtocolVersion;
     bool versionSent;
     QList<int> objRefs;
     FastCallbackRequestEventLoop *fcbWaitResult;
     BridgeTCPServer *srv;
     Qt::HANDLE threadId;    //to be used in safe requests
+    bool timestamps;        //enableTimestamps: метки этапов доставки в уведомлениях
+    quint64 connId;         //номер соединения для фильтров колбеков, не переиспользуется
     ConnectionData()
         : outMsgId(0),
           proto(nullptr),
           peerProtocolVersion(0),
           versionSent(false),
           fcbWaitResult(nullptr),
-          srv(nullptr)
+          srv(nullptr),
+          timestamps(false),
+          connId(0)
     {}
     ~ConnectionData();
 };
 Q_DECLARE_METATYPE(ConnectionData*)
 
-struct ParamSubs
+struct PendingBarsUpdate
 {
-    QString param;
-    QVariant value;
-    QMap<ConnectionData *, int> consumers;
-    QMutex mutex;
-    ParamSubs(QString pname) : param(pname){}
-    void addConsumer(ConnectionData *cd, int id);
-    bool delConsumer(ConnectionData *cd);
-    bool hasConsumer(ConnectionData *cd);
-    QList<ConnectionData *> consumersList();
-    int getSubscriptionId(ConnectionData *cd);
+    ConnectionData *cd;
+    int objId;
+    int reqId;
+    QString funName;
+    int from;
+    int to;
+    qint64 due;
+    QString seriesKey;  //общий источник данных сервера (BarSeries), а не объект клиента
 };
 
-struct SecSubs
+struct PendingParamSend
 {
-    QString secName;
-    QMap<QString, ParamSubs *> params;
-    QMap<ConnectionData *, int> quoteConsumers;
-    QMutex pmutex;
-    QMutex qmutex;
-    SecSubs(QString sec) : secName(sec){}
-    ~SecSubs();
-    void addConsumer(ConnectionData *cd, QString param, int id);
-    bool delConsumer(ConnectionData *cd, QString param);
-    bool clearAllSubscriptions(ConnectionData *cd);
-    ParamSubs *findParamSubscriptions(QString param);
-    void addQuotesConsumer(ConnectionData *cd, int id);
-    bool delQuotesConsumer(ConnectionData *cd);
-    bool hasQuotesConsumer(ConnectionData *cd = nullptr);
-    QStringList getParamsList();
-    QList<ConnectionData *> getQuotesConsumersList();
-    int getQuotesSubscriptionId(ConnectionData *cd);
+    quint64 key;
+    ConnectionData *cd;
 };
 
-struct ClsSubs
+struct GroupedParamsChange
 {
-    QString className;
-    QMap<QString, SecSubs *> securities;
-    QMutex mutex;
-    ClsSubs(QString cls) : className(cls){}
-    ~ClsSubs();
-    void addConsumer(ConnectionData *cd, QString sec, QString param, int id);
-    bool delConsumer(ConnectionData *cd, QString sec, QString param);
-    bool clearAllSubscriptions(ConnectionData *cd);
-    ParamSubs *findParamSubscriptions(QString sec, QString param);
-    SecSubs *findSecuritySubscriptions(QString sec);
-    void addQuotesConsumer(ConnectionData *cd, QString sec, int id);
-    bool delQuotesConsumer(ConnectionData *cd, QString sec);
+    int id;
+    QString cls;
+    QString sec;
+    QJsonObject params;
+    QJsonObject ts;
 };
+typedef QMap<QPair<ConnectionData *, SecurityEntry *>, GroupedParamsChange> GroupedParamsMap;
 
-class ParamSubscriptionsDb
+//Сериализованное тело уведомления. Вариант с метками этапов ("ts") собирается
+//лениво из готового plain, только если среди получателей есть включившие enableTimestamps
+struct NotificationBody
 {
-public:
-    ParamSubscriptionsDb();
-    ~ParamSubscriptionsDb();
-    void addConsumer(ConnectionData *cd, QString cls, QString sec, QString param, int id);
-    bool delConsumer(ConnectionData *cd, QString cls, QString sec, QString param);
-    bool clearAllSubscriptions(ConnectionData *cd);
-    ParamSubs *findParamSubscriptions(QString cls, QString sec, QString param);
-    SecSubs *findSecuritySubscriptions(QString cls, QString sec);
-    void addQuotesConsumer(ConnectionData *cd, QString cls, QString sec, int id);
-    bool delQuotesConsumer(ConnectionData *cd, QString cls, QString sec);
-private:
-    QMutex mutex;
-    QMap<QString, ClsSubs *> classes;
+    QByteArray plain;
+    QJsonObject ts;
+    QByteArray stamped;
+    NotificationBody(){}
+    NotificationBody(const QByteArray &p, const QJsonObject &t) : plain(p), ts(t){}
+    const QByteArray &bytes(bool withTs);
+};
+
+//Выборка load*-запроса по закешированным строкам или по зеркалу таблицы (mirror, тогда
+//candidates - номера строк зеркала). pos - позиция продолжения прохода (номер в rows или в candidates,
+//если строки отобраны индексом); по ней работают курсоры и потоковая выдача
+struct RowsQuery
+{
+    ConnectionData *cd;
+    int id;
+    QList<QVariantMap> rows;
+    TableMirror *mirror;
+    RowFilter flt;
+    QStringList fields;
+    QList<int> candidates;
+    bool indexed;
+    quint64 version;
+    int pos;
+    int chunk;
+    RowsQuery() : cd(nullptr), id(0), mirror(nullptr), indexed(false), version(0), pos(0), chunk(0){}
+    int count() const {return indexed ? candidates.count() : rows.count();}
+    bool next(int limit, QJsonArray &table);
+};
+
+//Подписка клиента на свечи общего источника данных
+struct BarsSubscription
+{
+    ConnectionData *cd;
+    int id;
+    QString key;
+};
+
+//getBars к источнику, история которого ещё не загрузилась: ответ ждёт первого заполнения
+//или истечения due (тогда отвечаем тем, что есть, с ready = false)
+struct PendingBarsRequest
+{
+    ConnectionData *cd;
+    int id;
+    QString key;
+    QJsonObject req;
+    qint64 due;
+};
+
+//Начальный снимок значений после массовой подписки на параметры: отдаётся порциями
+//по бумагам, pos - номер первой ещё не отправленной бумаги в secs
+struct ParamsSnapshotStream
+{
+    ConnectionData *cd;
+    int id;
+    QString cls;
+    QStringList secs;
+    QStringList pars;
+    int pos;
+};
+
+//Подписка клиента на изменения зеркала таблицы
+struct MirrorSubscription
+{
+    ConnectionData *cd;
+    int id;
+    QString table;
+    RowFilter flt;
+    QStringList fields;
 };
 
 void sendStdoutLine(QString line);
@@ -124,8 +175,11 @@ public:
     void setAllowedIPs(const QStringList &aips);
     void setLogPathPrefix(QString lpp);
     void setDebugLogPathPrefix(QString lpp);
+    void setJournalConfig(const QStringList &cbNames, int ringSize, QString spillPath, qint64 spillMaxSize);
+    void setReferenceDataConfig(int ttlSec, const QStringList &preloadClasses, QString snapshotPath);
+    void setInvokeRangeMax(int maxCount){invokeRangeMax = maxCount;}
 
-    virtual void callbackRequest(QString name, const QVariantList &args, QVariant &vres);
+    virtual void callbackRequest(QString name, const QVariantList &args, QVariant &vres, const CallbackDispatch *dispatch);
     virtual void fastCallbackRequest(void *data, const QVariantList &args, QVariant &res);
     virtual void clearFastCallbackData(void *data);
     virtual void sendStdoutLine(QString line);
@@ -135,16 +189,74 @@ private:
     QStringList m_allowedIps;
     bool ipAllowed(QString ip);
     QList<ConnectionData *> m_connections;
+    //callbackRequest читает соединения, их подписки на колбеки, фильтры и timestamps в потоке квика:
+    //поток сервера меняет их только под этим мьютексом (после journal.mutex, если берутся оба)
+    QMutex connectionsMutex;
+    quint64 lastConnectionId;
     QStringList activeCallbacks;
+    bool isInternalCallback(QString name);
+    void updateCallbackFilters(QString name);
+    void removeConnection(ConnectionData *cd);
+    QJsonObject callbackMessage(QString name, qint64 seq, const QVariantList &args);
+    CallbackJournal journal;
+    QTimer *journalSpillTimer;
     QString logPathPrefix;
     QFile *logf;
     QTextStream *logts;
 
     //cache
-    QStringList secClasses;
-    void cacheSecClasses();
+    ReferenceDataCache refData;
+    QStringList refDataPreload;
+    QStringList refDataPreloadQueue;
+    //снимок справочных данных на диске и очередь его фоновой сверки с терминалом
+    ReferenceDataSnapshot refSnapshot;
+    QStringList refSnapshotCheckQueue;
+    bool refSnapshotSavePending;
+    void scheduleReferenceSnapshotSave();
+    QStringList secClasses();
+    bool loadClassSecurities(QString cls, QList<QVariantMap> &rows, quint64 *version = nullptr);
+    QStringList classSecurityCodes(QString cls);
+    bool loadAccounts(QList<QVariantMap> &rows, quint64 *version = nullptr);
+    QList<RowsQuery *> rowStreams;
+    QList<ParamsSnapshotStream> paramSnapshots;
+    bool sendParamsSnapshotChunk(ParamsSnapshotStream &s);
+    int invokeRangeMax;   //наибольшая длина диапазона invokeRange, 0 - без ограничения
+    void answerRowsQuery(RowsQuery *q, QJsonObject &jobj);
+
+    //зеркала таблиц торговли, создаются при первом запросе к таблице
+    QMap<QString, TableMirror *> mirrors;
+    //какие таблицы зеркалируются (бит на TableMirror::specIndex), читается в потоке квика,
+    //чтобы колбеки таблиц без зеркала не ставились в очередь потока сервера
+    QAtomicInteger<quint32> mirroredTables;
+    QList<MirrorSubscription> mirrorSubscriptions;
+    TableMirror *ensureMirror(ConnectionData *cd, int id, QString table);
+
+    //общие для всех соединений источники данных, по одному на (класс, бумага, интервал)
+    QMap<QString, BarSeries *> barSeries;
+    QList<BarsSubscription> barsSubscriptions;
+    QList<PendingBarsRequest> pendingBarsRequests;
+    QTimer *barsIdleTimer;
+    BarSeries *ensureBarSeries(ConnectionData *cd, int id, QJsonObject &jobj);
+    int fillBarSeries(BarSeries *s, int from, int to);
+    void updateBarSeries(QString key, int from, int to);
+    void answerBarsRequest(ConnectionData *cd, int id, BarSeries *s, const QJsonObject &jobj);
+    void releaseBarSeries(QString key);
+    void closeBarSeries(BarSeries *s);
+
+    SubscriptionIndex paramSubscriptions;
+    TimerWheel<PendingParamSend> paramWheel;
+    QTimer *paramWheelTimer;
+    void offerParamChange(ParamEntry *p, ParamConsumer *pc, const QVariant &pval, NotificationBody &msg, qint64 now, GroupedParamsMap &groups);
+    void deliverParamChange(ParamEntry *p, ParamConsumer *pc, const QVariant &pval, NotificationBody &msg, GroupedParamsMap &groups);
+    void sendGroupedParams(const GroupedParamsMap &groups);
+    SecurityUpdateQueue updateQueue;
+    SecurityInterestSet securityInterest;
+    void updateSecurityInterest();
 
-    ParamSubscriptionsDb paramSubscriptions;
+    //накопленные диапазоны обновлений источников данных (callable в режиме coalesced)
+    QMutex barsMutex;
+    QMap<void *, PendingBarsUpdate> pendingBars;
+    QJsonArray readBars(int objId, int from, int &to);
 
     void safeSendReq(ConnectionData *cd, int id, QJsonValue data, bool showInLog=true);
     void safeSendAns(ConnectionData *cd, int id, QJsonValue data, bool showInLog=true);
@@ -158,9 +270,21 @@ private:
     void processLoadClassSecuritiesRequest(ConnectionData *cd, int id, QJsonObject &jobj);
     void processSubscribeParamChangesRequest(ConnectionData *cd, int id, QJsonObject &jobj);
     void processUnsubscribeParamChangesRequest(ConnectionData *cd, int id, QJsonObject &jobj);
+    void processBulkParamSubscription(ConnectionData *cd, int id, QString cls, bool subscribe, QJsonObject &jobj);
     void processExtendedAnswers(ConnectionData *cd, int id, QString method, QJsonObject &jobj);
     void processSubscribeQuotesRequest(ConnectionData *cd, int id, QJsonObject &jobj);
     void processUnsubscribeQuotesRequest(ConnectionData *cd, int id, QJsonObject &jobj);
+    void processRequestQuotesSnapshotRequest(ConnectionData *cd, int id, QJsonObject &jobj);
+    void processGetStatisticsRequest(ConnectionData *cd, int id, QJsonObject &jobj);
+    void processEnableTimestampsRequest(ConnectionData *cd, int id, QJsonObject &jobj);
+    void processQueryTableRequest(ConnectionData *cd, int id, QJsonObject &jobj);
+    void processQueryMirrorRequest(ConnectionData *cd, int id, QJsonObject &jobj);
+    void processSubscribeMirrorRequest(ConnectionData *cd, int id, QJsonObject &jobj);
+    void processUnsubscribeMirrorRequest(ConnectionData *cd, int id, QJsonObject &jobj);
+    void processInvokeRangeRequest(ConnectionData *cd, int id, QJsonObject &jobj);
+    void processGetBarsRequest(ConnectionData *cd, int id, QJsonObject &jobj);
+    void processSubscribeBarsRequest(ConnectionData *cd, int id, QJsonObject &jobj);
+    void processUnsubscribeBarsRequest(ConnectionData *cd, int id, QJsonObject &jobj);
 protected:
     virtual void incomingConnection(qintptr handle);
 private slots:
@@ -176,8 +300,22 @@ private slots:
 
     void fastCallbackRequestHandler(ConnectionData *cd, int oid, QString fname, QVariantList args);
 
-    void secParamsUpdate(QString cls, QString sec);
-    void secQuotesUpdate(QString cls, QString sec);
+    void secParamsUpdate(QString cls, QString sec, qint64 entryNs = 0);
+    void secQuotesUpdate(QString cls, QString sec, qint64 entryNs = 0);
+    void processSecurityUpdates();
+    void invalidateReferenceData();
+    void preloadReferenceData();
+    void verifyReferenceSnapshot();
+    void saveReferenceSnapshot();
+    void continueRowStreams();
+    void continueParamSnapshots();
+    void applyMirrorUpdate(QString name, QVariantMap row);
+    void flushJournal();
+    void scheduleBarsUpdate(int intervalMs);
+    void flushBarsUpdates();
+    void answerPendingBarsRequests();
+    void closeIdleBarSeries();
+    void flushParamWheel();
 signals:
     void fastCallbackRequestSent(ConnectionData *cd, QString fname, int id);
     void fastCallbackReturnArrived(ConnectionData *cd, int id, QVariant res);
@@ -0,0 +1,270 @@
+#include "callbackfilter.h"
+#include <QJsonObject>
+#include <QJsonArray>
+
+static bool addPredicateValue(CallbackFilterPredicate &p, const QJsonValue &jv)
+{
+    if(jv.isString())
+    {
+        QString sv = jv.toString();
+        p.strValues.insert(sv.toLocal8Bit());
+        bool ok;
+        double dv = sv.toDouble(&ok);
+        if(ok)
+            p.numValues.insert(CallbackFilterPredicate::numberKey(dv));
+        return true;
+    }
+    if(jv.isDouble())
+    {
+        p.numValues.insert(CallbackFilterPredicate::numberKey(jv.toDouble()));
+        return true;
+    }
+    return false;
+}
+
+bool CallbackFilterPredicate::matchLuaValue(lua_State *l, int idx) const
+{
+    int t = lua_type(l, idx);
+    if(kind == Range)
+    {
+        if(t != LUA_TNUMBER && t != LUA_TSTRING)
+            return false;
+        int isnum = 0;
+        double v = lua_tonumberx(l, idx, &isnum);
+        if(!isnum)
+            return false;
+        return (!hasMin || v >= minValue) && (!hasMax || v <= maxValue);
+    }
+    if(t == LUA_TSTRING && !strValues.isEmpty())
+    {
+        size_t len = 0;
+        const char *s = lua_tolstring(l, idx, &len);
+        if(strValues.contains(QByteArray::fromRawData(s, (int)len)))
+            return true;
+    }
+    if((t == LUA_TNUMBER || t == LUA_TSTRING) && !numValues.isEmpty())
+    {
+        int isnum = 0;
+        double v = lua_tonumberx(l, idx, &isnum);
+        if(isnum && numValues.contains(numberKey(v)))
+            return true;
+    }
+    return false;
+}
+
+bool CallbackFilterPredicate::matchVariant(const QVariant &val) const
+{
+    if(!val.isValid())
+        return false;
+    bool ok;
+    if(kind == Range)
+    {
+        double v = val.toDouble(&ok);
+        if(!ok)
+            return false;
+        return (!hasMin || v >= minValue) && (!hasMax || v <= maxValue);
+    }
+    if(val.type() == QVariant::String && strValues.contains(val.toString().toLocal8Bit()))
+        return true;
+    if(!numValues.isEmpty())
+    {
+        double v = val.toDouble(&ok);
+        if(ok && numValues.contains(numberKey(v)))
+            return true;
+    }
+    return false;
+}
+
+bool CallbackFilter::parse(const QJsonValue &jfilter, const QJsonValue &jfields, QString &errMsg)
+{
+    predicates.clear();
+    fields.clear();
+    if(!jfilter.isUndefined() && !jfilter.isNull())
+    {
+        if(!jfilter.isObject())
+        {
+            errMsg = "'filter' must be an object";
+            return false;
+        }
+        QJsonObject jobj = jfilter.toObject();
+        QJsonObject::const_iterator it;
+        for(it = jobj.constBegin(); it != jobj.constEnd(); ++it)
+        {
+            CallbackFilterPredicate p;
+            p.name = it.key();
+            p.key = p.name.toLocal8Bit();
+            QJsonValue jv = it.value();
+            if(jv.isArray())
+            {
+                QJsonArray jarr = jv.toArray();
+                int i;
+                for(i=0; i<jarr.count(); i++)
+                {
+                    if(!addPredicateValue(p, jarr.at(i)))
+                    {
+                        errMsg = QString("Wrong value in set of filter key %1").arg(it.key());
+                        return false;
+                    }
+                }
+            }
+            else if(jv.isObject())
+            {
+                QJsonObject jrange = jv.toObject();
+                p.kind = CallbackFilterPredicate::Range;
+                if(jrange.contains("min"))
+                {
+                    p.hasMin = true;
+                    p.minValue = jrange.value("min").toDouble();
+                }
+                if(jrange.contains("max"))
+                {
+                    p.hasMax = true;
+                    p.maxValue = jrange.value("max").toDouble();
+                }
+                if(!p.hasMin && !p.hasMax)
+                {
+                    errMsg = QString("Range of filter key %1 must have 'min' or 'max'").arg(it.key());
+                    return false;
+                }
+            }
+            else if(!addPredicateValue(p, jv))
+            {
+                errMsg = QString("Wrong value of filter key %1").arg(it.key());
+                return false;
+            }
+            predicates.append(p);
+        }
+    }
+    if(!jfields.isUndefined() && !jfields.isNull())
+    {
+        if(!jfields.isArray())
+        {
+            errMsg = "'fields' must be an array of strings";
+            return false;
+        }
+        QJsonArray jarr = jfields.toArray();
+        int i;
+        for(i=0; i<jarr.count(); i++)
+        {
+            QString fname = jarr.at(i).toString();
+            if(!fname.isEmpty() && !fields.contains(fname))
+                fields.append(fname);
+        }
+    }
+    return true;
+}
+
+bool CallbackFilter::matchLuaTable(lua_State *l, int idx) const
+{
+    idx = lua_absindex(l, idx);
+    int i;
+    for(i=0; i<predicates.count(); i++)
+    {
+        const CallbackFilterPredicate &p = predicates.at(i);
+        lua_getfield(l, idx, p.key.constData());
+        bool res = p.matchLuaValue(l, -1);
+        lua_pop(l, 1);
+        if(!res)
+            return false;
+    }
+    return true;
+}
+
+bool CallbackFilter::matchRow(const QVariantMap &row) const
+{
+    int i;
+    for(i=0; i<predicates.count(); i++)
+    {
+        const CallbackFilterPredicate &p = predicates.at(i);
+        if(!p.matchVariant(row.value(p.name)))
+            return false;
+    }
+    return true;
+}
+
+bool CallbackFilter::matchArguments(const QVariantList &args) const
+{
+    if(predicates.isEmpty())
+        return true;
+    int i;
+    for(i=0; i<args.count(); i++)
+    {
+        if(args.at(i).type() == QVariant::Map)
+            return matchRow(args.at(i).toMap());
+    }
+    return true;
+}
+
+QVariantMap CallbackFilter::projectRow(const QVariantMap &row) const
+{
+    if(fields.isEmpty())
+        return row;
+    QVariantMap res;
+    foreach (QString fname, fields)
+    {
+        if(row.contains(fname))
+            res.insert(fname, row.value(fname));
+    }
+    return res;
+}
+
+QVariantList CallbackFilter::projectArguments(const QVariantList &args) const
+{
+    if(fields.isEmpty())
+        return args;
+    QVariantList res = args;
+    int i;
+    for(i=0; i<res.count(); i++)
+    {
+        if(res.at(i).type() == QVariant::Map)
+        {
+            res[i] = projectRow(res.at(i).toMap());
+            break;
+        }
+    }
+    return res;
+}
+
+int findFirstTableArgument(lua_State *l, int top)
+{
+    int i;
+    for(i = 1; i <= top; i++)
+    {
+        if(lua_type(l, i) == LUA_TTABLE)
+            return i;
+    }
+    return 0;
+}
+
+bool matchCallbackFilters(const CallbackFilterList &flist, lua_State *l, int top, CallbackDispatch &dispatch)
+{
+    dispatch.filtered = false;
+    dispatch.subscribers.clear();
+    dispatch.fields.clear();
+    int tidx = findFirstTableArgument(l, top);
+    if(!tidx)
+        return !flist.isEmpty();
+    bool fullRow = false;
+    int i;
+    for(i=0; i<flist.count(); i++)
+    {
+        const CallbackFilterEntry &e = flist.at(i);
+        if(!e.filter.matchLuaTable(l, tidx))
+            continue;
+        dispatch.subscribers.insert(e.subscriber);
+        if(e.filter.projection().isEmpty())
+            fullRow = true;
+        else
+        {
+            foreach (QString fname, e.filter.projection())
+            {
+                if(!dispatch.fields.contains(fname))
+                    dispatch.fields.append(fname);
+            }
+        }
+    }
+    if(fullRow)
+        dispatch.fields.clear();
+    dispatch.filtered = true;
+    return !dispatch.subscribers.isEmpty();
+}
@@ -0,0 +1,90 @@
+#ifndef CALLBACKFILTER_H
+#define CALLBACKFILTER_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QList>
+#include <QSet>
+#include <QVariant>
+#include <QJsonValue>
+#include <lua.hpp>
+
+//Одно условие фильтра: значение поля должно входить в множество (равенство - частный случай)
+//либо попадать в числовой диапазон
+struct CallbackFilterPredicate
+{
+    enum Kind
+    {
+        InSet,
+        Range
+    };
+    Kind kind;
+    QString name;
+    QByteArray key;
+    QSet<QByteArray> strValues;
+    QSet<QByteArray> numValues;     //числа множества в нормализованной записи (numberKey)
+    bool hasMin;
+    bool hasMax;
+    double minValue;
+    double maxValue;
+    CallbackFilterPredicate()
+        : kind(InSet),
+          hasMin(false),
+          hasMax(false),
+          minValue(0),
+          maxValue(0)
+    {}
+    bool matchLuaValue(lua_State *l, int idx) const;
+    bool matchVariant(const QVariant &val) const;
+    //15 значащих цифр: 0.1+0.2 из луа и 0.3 из json дают одну запись
+    static QByteArray numberKey(double v) {return QByteArray::number(v, 'g', 15);}
+};
+
+//Фильтр подписки на колбек. Условия проверяются по первому аргументу-таблице колбека
+//(alltrade, order, trade и т.д.), колбеки без таблиц в аргументах не фильтруются.
+//fields - необязательная проекция: какие поля таблицы отдавать подписчику
+class CallbackFilter
+{
+public:
+    CallbackFilter(){}
+    bool parse(const QJsonValue &jfilter, const QJsonValue &jfields, QString &errMsg);
+    bool isEmpty() const {return predicates.isEmpty() && fields.isEmpty();}
+    bool hasPredicates() const {return !predicates.isEmpty();}
+    const QStringList &projection() const {return fields;}
+    bool matchLuaTable(lua_State *l, int idx) const;
+    bool matchRow(const QVariantMap &row) const;
+    bool matchArguments(const QVariantList &args) const;
+    QVariantMap projectRow(const QVariantMap &row) const;
+    QVariantList projectArguments(const QVariantList &args) const;
+private:
+    QList<CallbackFilterPredicate> predicates;
+    QStringList fields;
+};
+
+//Подписчик задаётся номером, а не указателем: соединение может быть удалено, а его адрес
+//занят новым, пока поток квика ещё разбирает событие по старому списку фильтров
+struct CallbackFilterEntry
+{
+    quint64 subscriber;
+    CallbackFilter filter;
+    CallbackFilterEntry() : subscriber(0){}
+    CallbackFilterEntry(quint64 s, const CallbackFilter &f) : subscriber(s), filter(f){}
+};
+typedef QList<CallbackFilterEntry> CallbackFilterList;
+
+//Результат проверки фильтров на стеке луа, передаётся вместе с аргументами колбека
+struct CallbackDispatch
+{
+    bool filtered;              //false - фильтры не применялись, отдаём всем подписчикам
+    QSet<quint64> subscribers;  //номера подписчиков, чьи фильтры пропустили событие
+    QStringList fields;         //объединение проекций; пусто - таблица целиком
+    qint64 entryNs;             //входа в колбек и конца разбора аргументов (monotonicNs)
+    qint64 parsedNs;
+    CallbackDispatch() : filtered(false), entryNs(0), parsedNs(0){}
+};
+
+int findFirstTableArgument(lua_State *l, int top);
+bool matchCallbackFilters(const CallbackFilterList &flist, lua_State *l, int top, CallbackDispatch &dispatch);
+
+#endif // CALLBACKFILTER_H
@@ -0,0 +1,208 @@
+#include "callbackjournal.h"
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <algorithm>
+
+#define JOURNAL_SPILL_INDEX_STEP    64
+
+CallbackJournal::CallbackJournal()
+    : capacity(0),
+      nextSeq(1),
+      epoch(0),
+      spillFile(nullptr),
+      spillMax(0),
+      firstSpilledSeq(0)
+{
+}
+
+CallbackJournal::~CallbackJournal()
+{
+    if(spillFile)
+    {
+        spillFile->close();
+        delete spillFile;
+    }
+}
+
+void CallbackJournal::configure(const QStringList &cbNames, int ringSize, QString spillFilePath, qint64 spillMaxSize)
+{
+    mutex.lock();
+    names = cbNames;
+    capacity = ringSize;
+    epoch = QDateTime::currentMSecsSinceEpoch();
+    spillPath = spillFilePath;
+    spillMax = spillMaxSize;
+    if(!spillPath.isEmpty() && !spillFile)
+    {
+        //предыдущий файл остался от прошлого запуска, номера в нём из другой эпохи
+        QFile::remove(spillPath + ".1");
+        QFile *tmpf = new QFile(spillPath);
+        if(tmpf->open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        {
+            spillFile = tmpf;
+            SpillSegment seg;
+            seg.path = spillPath;
+            segments.append(seg);
+        }
+        else
+            delete tmpf;
+    }
+    mutex.unlock();
+}
+
+qint64 CallbackJournal::append(QString name, const QVariantList &args)
+{
+    CallbackJournalEvent ev;
+    ev.seq = nextSeq++;
+    ev.name = name;
+    ev.args = args;
+    ring.append(ev);
+    while(ring.count() > capacity)
+    {
+        if(spillFile)
+            spillQueue.append(ring.takeFirst());
+        else
+            ring.removeFirst();
+    }
+    return ev.seq;
+}
+
+bool CallbackJournal::eventsFrom(qint64 fromSeq, QString name, QList<CallbackJournalEvent> &events)
+{
+    events.clear();
+    if(fromSeq > nextSeq)
+        return false;
+    qint64 oldest = nextSeq;
+    if(firstSpilledSeq)
+        oldest = firstSpilledSeq;
+    else if(!spillQueue.isEmpty())
+        oldest = spillQueue.first().seq;
+    else if(!ring.isEmpty())
+        oldest = ring.first().seq;
+    bool complete = (fromSeq >= oldest);
+    if(firstSpilledSeq)
+    {
+        qint64 spilledTo = spillQueue.isEmpty() ? (ring.isEmpty() ? nextSeq : ring.first().seq) : spillQueue.first().seq;
+        if(fromSeq < spilledTo)
+            readSpilled(fromSeq, spilledTo, name, events);
+    }
+    int i;
+    for(i=0; i<spillQueue.count(); i++)
+    {
+        const CallbackJournalEvent &ev = spillQueue.at(i);
+        if(ev.seq >= fromSeq && ev.name == name)
+            events.append(ev);
+    }
+    for(i=0; i<ring.count(); i++)
+    {
+        const CallbackJournalEvent &ev = ring.at(i);
+        if(ev.seq >= fromSeq && ev.name == name)
+            events.append(ev);
+    }
+    return complete;
+}
+
+void CallbackJournal::flushSpill()
+{
+    QList<CallbackJournalEvent> toWrite;
+    mutex.lock();
+    toWrite.swap(spillQueue);
+    mutex.unlock();
+    if(toWrite.isEmpty() || !spillFile)
+        return;
+    //пишем вне мьютекса, чтобы не задерживать поток квика дисковыми операциями;
+    //чтение (eventsFrom) идёт в том же потоке, что и запись, поэтому файл не пересекается
+    int i;
+    for(i=0; i<toWrite.count(); i++)
+    {
+        if(spillMax > 0 && spillFile->pos() >= spillMax / 2)
+            rotateSpill();
+        if(!spillFile)
+            return;
+        const CallbackJournalEvent &ev = toWrite.at(i);
+        SpillSegment &seg = segments.last();
+        if(!seg.count)
+            seg.firstSeq = ev.seq;
+        if(seg.count % JOURNAL_SPILL_INDEX_STEP == 0)
+        {
+            seg.indexSeqs.append(ev.seq);
+            seg.indexOffsets.append(spillFile->pos());
+        }
+        seg.count++;
+        QJsonObject jev
+        {
+            {"seq", ev.seq},
+            {"name", ev.name},
+            {"arguments", QJsonArray::fromVariantList(ev.args)}
+        };
+        spillFile->write(QJsonDocument(jev).toJson(QJsonDocument::Compact));
+        spillFile->write("\n");
+    }
+    spillFile->flush();
+    firstSpilledSeq = segments.first().firstSeq;
+}
+
+void CallbackJournal::rotateSpill()
+{
+    //текущий файл становится предыдущим, а прежний предыдущий со всеми его событиями
+    //выбрасывается: граница повтора сдвигается на первое событие оставшегося файла
+    spillFile->close();
+    QString prevPath = spillPath + ".1";
+    if(segments.count() > 1)
+        segments.removeFirst();
+    QFile::remove(prevPath);
+    if(QFile::rename(spillPath, prevPath))
+        segments.last().path = prevPath;
+    else
+        segments.clear();
+    if(!spillFile->open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+    {
+        delete spillFile;
+        spillFile = nullptr;
+        return;
+    }
+    SpillSegment seg;
+    seg.path = spillPath;
+    segments.append(seg);
+}
+
+void CallbackJournal::readSpilled(qint64 fromSeq, qint64 toSeq, QString name, QList<CallbackJournalEvent> &events)
+{
+    int s;
+    for(s=0; s<segments.count(); s++)
+    {
+        const SpillSegment &seg = segments.at(s);
+        if(!seg.count)
+            continue;
+        //файл целиком раньше fromSeq, если следующий начинается не позже
+        if(s + 1 < segments.count() && segments.at(s + 1).count && segments.at(s + 1).firstSeq <= fromSeq)
+            continue;
+        QFile rf(seg.path);
+        if(!rf.open(QIODevice::ReadOnly | QIODevice::Text))
+            continue;
+        //начинаем с ближайшей индексной точки не позже fromSeq
+        int ipos = (int)(std::upper_bound(seg.indexSeqs.constBegin(), seg.indexSeqs.constEnd(), fromSeq) - seg.indexSeqs.constBegin()) - 1;
+        if(ipos > 0)
+            rf.seek(seg.indexOffsets.at(ipos));
+        while(!rf.atEnd())
+        {
+            QByteArray line = rf.readLine();
+            QJsonDocument jdoc = QJsonDocument::fromJson(line);
+            if(!jdoc.isObject())
+                continue;
+            QJsonObject jev = jdoc.object();
+            qint64 seq = (qint64)jev.value("seq").toDouble();
+            if(seq >= toSeq)
+                return;
+            if(seq < fromSeq || jev.value("name").toString() != name)
+                continue;
+            CallbackJournalEvent ev;
+            ev.seq = seq;
+            ev.name = name;
+            ev.args = jev.value("arguments").toArray().toVariantList();
+            events.append(ev);
+        }
+    }
+}
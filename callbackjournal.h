@@ -0,0 +1,68 @@
+#ifndef CALLBACKJOURNAL_H
+#define CALLBACKJOURNAL_H
+
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+#include <QList>
+#include <QMutex>
+#include <QFile>
+#include <QVector>
+
+struct CallbackJournalEvent
+{
+    qint64 seq;
+    QString name;
+    QVariantList args;
+    CallbackJournalEvent() : seq(0){}
+};
+
+//Журнал событий именованных колбеков с монотонными номерами.
+//Последние события хранятся в кольце ограниченного размера, вытесненные
+//могут сбрасываться на диск. Методы append и eventsFrom вызываются под mutex,
+//чтобы запись в журнал и рассылка подписчикам шли атомарно относительно новых подписок.
+//Файл сброса ротируется: когда он дорастает до половины spillMaxSize, он становится
+//предыдущим (.1), а самый старый удаляется, так что на диске не больше spillMaxSize.
+//По каждому файлу ведётся разреженный индекс seq -> смещение, повтор читает с нужного места.
+class CallbackJournal
+{
+public:
+    CallbackJournal();
+    ~CallbackJournal();
+    void configure(const QStringList &cbNames, int ringSize, QString spillFilePath, qint64 spillMaxSize = 0);
+    bool isEnabled() const {return capacity > 0;}
+    bool isJournaled(QString name) const {return capacity > 0 && names.contains(name);}
+    const QStringList &journaledCallbacks() const {return names;}
+    qint64 getEpoch() const {return epoch;}
+    qint64 lastSeq() const {return nextSeq - 1;}
+    qint64 append(QString name, const QVariantList &args);
+    //события с номерами от fromSeq включительно; false - часть из них уже вытеснена
+    bool eventsFrom(qint64 fromSeq, QString name, QList<CallbackJournalEvent> &events);
+    void flushSpill();
+    QMutex mutex;
+private:
+    QStringList names;
+    int capacity;
+    qint64 nextSeq;
+    qint64 epoch;
+    QList<CallbackJournalEvent> ring;
+    QList<CallbackJournalEvent> spillQueue;
+    struct SpillSegment
+    {
+        QString path;
+        qint64 firstSeq;
+        int count;
+        QVector<qint64> indexSeqs;      //seq каждого JOURNAL_SPILL_INDEX_STEP-го события файла
+        QVector<qint64> indexOffsets;   //и смещение его строки
+        SpillSegment() : firstSeq(0), count(0){}
+    };
+    QString spillPath;
+    QFile *spillFile;
+    qint64 spillMax;
+    QList<SpillSegment> segments;   //предыдущий (если есть) и текущий файл
+    qint64 firstSpilledSeq;
+    void rotateSpill();
+    void readSpilled(qint64 fromSeq, qint64 toSeq, QString name, QList<CallbackJournalEvent> &events);
+};
+
+#endif // CALLBACKJOURNAL_H
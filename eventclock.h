@@ -0,0 +1,36 @@
+#ifndef EVENTCLOCK_H
+#define EVENTCLOCK_H
+
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QJsonObject>
+
+//Монотонные часы для меток этапов доставки событий: наносекунды от первого обращения
+//(загрузки плагина). Отсчёт от старта, а не от загрузки системы, чтобы значения
+//оставались точными в double (JSON) ещё ~100 суток работы терминала.
+inline QElapsedTimer &eventClockBase()
+{
+    static QElapsedTimer base;
+    static bool started = (base.start(), true);
+    Q_UNUSED(started)
+    return base;
+}
+
+inline qint64 monotonicNs()
+{
+    return eventClockBase().nsecsElapsed();
+}
+
+//Привязка монотонных часов к настенным: в один момент берутся обе шкалы
+inline QJsonObject eventClockAnchor()
+{
+    qint64 mono = monotonicNs();
+    QJsonObject anchor
+    {
+        {"mono", mono},
+        {"wall", QDateTime::currentMSecsSinceEpoch()}
+    };
+    return anchor;
+}
+
+#endif // EVENTCLOCK_H
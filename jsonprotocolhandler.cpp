@@ -1,5 +1,6 @@
 #include "jsonprotocolhandler.h"
 #include <QTimer>
+#include "eventclock.h"
 
 JsonProtocolHandler::JsonProtocolHandler(QTcpSocket *sock,  QString logFileName, QObject *parent)
     : QObject(parent), logf(0), logts(0)//, win1251(QTextCodec::codecForName("Windows-1251"))
@@ -19,6 +20,7 @@ JsonProtocolHandler::JsonProtocolHandler(QTcpSocket *sock,  QString logFileName,
     //socket->setParent(this);
     peerEnded=false;
     weEnded=false;
+    writeTimestamps=false;
     connect(socket, SIGNAL(errorOccurred(QAbstractSocket::SocketError)), this, SLOT(errorThunk(QAbstractSocket::SocketError)));
     connect(socket, SIGNAL(readyRead()), this, SLOT(readyRead()));
     connect(socket, SIGNAL(disconnected()), this, SLOT(disconnected()));
@@ -86,6 +88,8 @@ void JsonProtocolHandler::sendReq(int id, QJsonValue data, bool showInLog)
         {"type", QString("req")},
         {"data", data}
     };
+    if(writeTimestamps)
+        jobj.insert("ts", monotonicNs());
     QJsonDocument jdoc(jobj);
     QByteArray msg = jdoc.toJson(QJsonDocument::Compact);
     if(showInLog)
@@ -99,6 +103,40 @@ void JsonProtocolHandler::sendReq(int id, QJsonValue data, bool showInLog)
     //qDebug() << "Sent";
 }
 
+//data - уже сериализованное тело (compact JSON). Одно и то же тело можно отправить
+//нескольким клиентам без повторной сериализации, меняется только id в конверте.
+//Ключи конверта идут в том же порядке, что даёт QJsonDocument, поэтому кадр не отличается от sendReq.
+void JsonProtocolHandler::sendReqData(int id, const QByteArray &data, bool showInLog)
+{
+    if(weEnded)
+        return;
+    if(!socketValid())
+    {
+        weEnded = true;
+        return;
+    }
+    QByteArray msg;
+    msg.reserve(data.size() + 32);
+    msg.append("{\"data\":");
+    msg.append(data);
+    msg.append(",\"id\":");
+    msg.append(QByteArray::number(id));
+    if(writeTimestamps)
+    {
+        msg.append(",\"ts\":");
+        msg.append(QByteArray::number(monotonicNs()));
+    }
+    msg.append(",\"type\":\"req\"}");
+    if(showInLog)
+    {
+        qDebug() << (QString("Send req[%1]:").arg(id) + QString::fromLocal8Bit(msg));
+    }
+    logOutgoing(msg);
+
+    socket->write(msg);
+    socket->flush();
+}
+
 void JsonProtocolHandler::sendAns(int id, QJsonValue data, bool showInLog)
 {
     if(weEnded)
@@ -114,6 +152,8 @@ void JsonProtocolHandler::sendAns(int id, QJsonValue data, bool showInLog)
         {"type", QString("ans")},
         {"data", data}
     };
+    if(writeTimestamps)
+        jobj.insert("ts", monotonicNs());
     QJsonDocument jdoc(jobj);
     QByteArray msg = jdoc.toJson(QJsonDocument::Compact);
     if(showInLog)
@@ -28,8 +28,12 @@ public:
 
     void forceDisconnect();
     void safeAbort();
+    //метка записи в сокет ("ts", monotonicNs) в конверте каждого исходящего req/ans
+    void setWriteTimestamps(bool on){writeTimestamps = on;}
+    bool hasWriteTimestamps() const {return writeTimestamps;}
 public slots:
     void sendReq(int id, QJsonValue data, bool showInLog=true);
+    void sendReqData(int id, const QByteArray &data, bool showInLog=true);
     void sendAns(int id, QJsonValue data, bool showInLog=true);
     void sendVer(int ver);
     void end(bool force=false);
@@ -39,6 +43,7 @@ private:
     QTcpSocket * socket;
     bool peerEnded;
     bool weEnded;
+    bool writeTimestamps;
     QByteArray incommingBuf;
     //QTextCodec *win1251;
     void processBuffer();
@@ -16,6 +16,9 @@ int qtMain(int argc, char *argv[])
     server.setAllowedIPs(cfgrdr.getAllowedIPs());
     server.setLogPathPrefix(cfgrdr.getLogPathPrefix());
     server.setDebugLogPathPrefix(cfgrdr.getDebugLogPathPrefix());
+    server.setJournalConfig(cfgrdr.getJournalCallbacks(), cfgrdr.getJournalSize(), cfgrdr.getJournalSpillPath(), cfgrdr.getJournalSpillMaxSize());
+    server.setReferenceDataConfig(cfgrdr.getReferenceDataTtl(), cfgrdr.getReferenceDataPreload(), cfgrdr.getReferenceDataSnapshotPath());
+    server.setInvokeRangeMax(cfgrdr.getInvokeRangeMax());
     QString msg;
     QTextStream ts2m(&msg);
     ts2m << "start listening on " << cfgrdr.getHost().toString() << ":" << cfgrdr.getPort();
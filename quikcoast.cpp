@@ -1,5 +1,6 @@
 #include "quikcoast.h"
 #include "quikqtbridge.h"
+#include "eventclock.h"
 
 #include <QDebug>
 #include <QThread>
@@ -576,6 +577,197 @@ bool invokeQuikObject(int objid, QString method, const QVariantList &args, QVari
     return true;
 }
 
+//Методы объекта для всех индексов from..to за один проход: методы ищутся в объекте один раз,
+//результат - по массиву значений на каждый метод. Если у объекта есть Size (источник данных),
+//to ограничивается им (в to возвращается последний прочитанный индекс, при пустом диапазоне - меньше from);
+//диапазон длиннее maxCount (0 - без ограничения) отвергается
+bool invokeQuikObjectRange(int objid, const QStringList &methods, int from, int &to, int maxCount, QList<QVariantList> &columns, QString &errMsg)
+{
+    columns.clear();
+    errMsg.clear();
+    lua_State *recentStack = getRecentStack();
+    if(!recentStack)
+    {
+        errMsg = "No stack?!";
+        return false;
+    }
+    if(!lua_checkstack(recentStack, methods.count() + 4))
+    {
+        errMsg = "Lua stack overflow";
+        return false;
+    }
+    int top = lua_gettop(recentStack);
+    lua_rawgeti(recentStack, LUA_REGISTRYINDEX, objid);
+    if(!lua_istable(recentStack, -1) && !lua_isuserdata(recentStack, -1))
+    {
+        lua_settop(recentStack, top);
+        errMsg = QString("Object %1 is unknown").arg(objid);
+        return false;
+    }
+    int oidx = lua_gettop(recentStack);
+    lua_getfield(recentStack, oidx, "Size");
+    if(lua_isfunction(recentStack, -1))
+    {
+        lua_pushvalue(recentStack, oidx);
+        if(lua_pcall(recentStack, 1, 1, 0))
+        {
+            errMsg = QString::fromLocal8Bit(lua_tostring(recentStack, -1));
+            lua_settop(recentStack, top);
+            return false;
+        }
+        if(lua_isnumber(recentStack, -1))
+            to = qMin(to, (int)lua_tointeger(recentStack, -1));
+    }
+    lua_settop(recentStack, oidx);
+    if(to < from)
+    {
+        //весь диапазон за концом источника: по пустому массиву на метод
+        for(int m=0; m<methods.count(); m++)
+            columns.append(QVariantList());
+        lua_settop(recentStack, top);
+        return true;
+    }
+    if(maxCount > 0 && (qint64)to - from + 1 > maxCount)
+    {
+        lua_settop(recentStack, top);
+        errMsg = QString("Range %1..%2 exceeds the limit of %3 indexes").arg(from).arg(to).arg(maxCount);
+        return false;
+    }
+    int m;
+    for(m=0; m<methods.count(); m++)
+    {
+        lua_getfield(recentStack, oidx, methods.at(m).toLocal8Bit().data());
+        if(!lua_isfunction(recentStack, -1))
+        {
+            lua_settop(recentStack, top);
+            errMsg = QString("obj%1.%2 is not a function").arg(objid).arg(methods.at(m));
+            return false;
+        }
+        columns.append(QVariantList());
+        columns[m].reserve(to - from + 1);
+    }
+    int i;
+    for(i=from; i<=to; i++)
+    {
+        for(m=0; m<methods.count(); m++)
+        {
+            lua_pushvalue(recentStack, oidx + 1 + m);
+            lua_pushvalue(recentStack, oidx);
+            lua_pushinteger(recentStack, i);
+            if(lua_pcall(recentStack, 2, 1, 0))
+            {
+                errMsg = QString::fromLocal8Bit(lua_tostring(recentStack, -1));
+                lua_settop(recentStack, top);
+                return false;
+            }
+            columns[m].append(popVariantFromLuaStack(recentStack));
+        }
+    }
+    lua_settop(recentStack, top);
+    return true;
+}
+
+bool invokeQuikBatch(QString method, const QList<QVariantList> &argsList, QVariantList &res, QString &errMsg)
+{
+    res.clear();
+    errMsg.clear();
+    lua_State *recentStack = getRecentStack();
+    if(!recentStack)
+    {
+        errMsg = "No stack?!";
+        return false;
+    }
+    int top = lua_gettop(recentStack);
+    lua_getglobal(recentStack, method.toLocal8Bit().data());
+    if(!lua_isfunction(recentStack, -1))
+    {
+        lua_settop(recentStack, top);
+        errMsg = QString("%1 is not a function").arg(method);
+        return false;
+    }
+    int fidx = lua_gettop(recentStack);
+    int i, li;
+    for(i=0; i<argsList.count(); i++)
+    {
+        const QVariantList &args = argsList.at(i);
+        lua_pushvalue(recentStack, fidx);
+        for(li=0; li<args.count(); li++)
+            pushVariantToLuaStack(recentStack, args.at(li), method);
+        if(lua_pcall(recentStack, li, 1, 0))
+        {
+            errMsg = QString::fromLocal8Bit(lua_tostring(recentStack, -1));
+            lua_settop(recentStack, top);
+            return false;
+        }
+        res.append(popVariantFromLuaStack(recentStack));
+    }
+    lua_settop(recentStack, top);
+    return true;
+}
+
+//ссылка на getParamEx2 в реестре, чтобы не искать глобал на каждый параметр.
+//Реестр свой у каждого состояния луа, а DLL переживает перезапуск скрипта, поэтому
+//ссылка сбрасывается при загрузке библиотеки и освобождается при остановке моста
+static int getParamEx2Ref = LUA_NOREF;
+
+static void releaseParamEx2Ref(lua_State *l)
+{
+    if(l && getParamEx2Ref != LUA_NOREF)
+        luaL_unref(l, LUA_REGISTRYINDEX, getParamEx2Ref);
+    getParamEx2Ref = LUA_NOREF;
+}
+
+bool fetchQuikParams(QString cls, QString sec, const QStringList &params, QVariantList &values, QString &errMsg)
+{
+    values.clear();
+    errMsg.clear();
+    lua_State *recentStack = getRecentStack();
+    if(!recentStack)
+    {
+        errMsg = "No stack?!";
+        return false;
+    }
+    int top = lua_gettop(recentStack);
+    if(getParamEx2Ref == LUA_NOREF)
+    {
+        lua_getglobal(recentStack, "getParamEx2");
+        if(!lua_isfunction(recentStack, -1))
+        {
+            lua_settop(recentStack, top);
+            errMsg = "getParamEx2 is not a function";
+            return false;
+        }
+        getParamEx2Ref = luaL_ref(recentStack, LUA_REGISTRYINDEX);
+    }
+    QByteArray bcls = cls.toLocal8Bit();
+    QByteArray bsec = sec.toLocal8Bit();
+    int i;
+    for(i=0; i<params.count(); i++)
+    {
+        QByteArray bpar = params.at(i).toLocal8Bit();
+        lua_rawgeti(recentStack, LUA_REGISTRYINDEX, getParamEx2Ref);
+        lua_pushlstring(recentStack, bcls.constData(), bcls.size());
+        lua_pushlstring(recentStack, bsec.constData(), bsec.size());
+        lua_pushlstring(recentStack, bpar.constData(), bpar.size());
+        if(lua_pcall(recentStack, 3, 1, 0))
+        {
+            errMsg = QString::fromLocal8Bit(lua_tostring(recentStack, -1));
+            lua_settop(recentStack, top);
+            return false;
+        }
+        //из таблицы результата нужно только значение, остальные поля не разбираем
+        if(lua_istable(recentStack, -1))
+        {
+            lua_getfield(recentStack, -1, "param_value");
+            values.append(popVariantFromLuaStack(recentStack));
+        }
+        else
+            values.append(QVariant());
+        lua_settop(recentStack, top);
+    }
+    return true;
+}
+
 void deleteQuikObject(int objid)
 {
     lua_State *recentStack = getRecentStack();
@@ -602,6 +794,7 @@ static int mainTrampoline(lua_State *l)
     char * argv[] = {savedScriptPath, NULL};
     setRecentStack(l);
     qtMain(argc, argv);
+    releaseParamEx2Ref(l);
     QuikQtBridge::deinitQuikQtBridge();
     return 0;
 }
@@ -672,6 +865,8 @@ static struct luaL_Reg ls_lib[] = {
 
 int luaopenImp(lua_State *l)
 {
+    //новое состояние луа: ссылка от прошлого запуска указывает в чужой реестр
+    getParamEx2Ref = LUA_NOREF;
     luaL_newlib(l, ls_lib);
     lua_register(l, "OnInit", onInitHandler);
     registerPredefinedNamedCallback(l, "OnFirm");
@@ -702,6 +897,164 @@ int luaopenImp(lua_State *l)
     return 0;
 }
 
+static void extractProjectedTable(lua_State *l, int sid, const QStringList &fields, QVariantMap &mVal)
+{
+    mVal.clear();
+    foreach (QString fname, fields)
+    {
+        lua_getfield(l, sid, fname.toLocal8Bit().data());
+        if(lua_type(l, -1) == LUA_TNIL)
+            lua_pop(l, 1);
+        else
+            mVal.insert(fname, popVariantFromLuaStack(l));
+    }
+}
+
+//Предикат для SearchItems: получает значения полей фильтра строки таблицы квика
+//в порядке upvalue 2 и проверяет их фильтром из upvalue 1
+static int searchItemsPredicate(lua_State *l)
+{
+    const RowFilter *flt = reinterpret_cast<const RowFilter *>(lua_touserdata(l, lua_upvalueindex(1)));
+    const QStringList *keys = reinterpret_cast<const QStringList *>(lua_touserdata(l, lua_upvalueindex(2)));
+    int top = lua_gettop(l);
+    QVariantMap row;
+    int i;
+    for(i=0; i<keys->count() && i<top; i++)
+    {
+        if(lua_type(l, i + 1) == LUA_TNIL)
+            continue;
+        lua_pushvalue(l, i + 1);
+        row.insert(keys->at(i), popVariantFromLuaStack(l));
+    }
+    lua_pushboolean(l, flt->match(row));
+    return 1;
+}
+
+//Выборка строк таблицы квика за один проход в потоке луа. Если у фильтра есть условия
+//и в терминале есть SearchItems, отбор идёт им (в getItem уходят только найденные строки),
+//иначе перебором getItem с проверкой фильтра. Из строк разбираются только нужные поля.
+bool queryQuikTable(QString table, const RowFilter &flt, const QStringList &fields, int limit, QList<QVariantMap> &rows, QString &errMsg)
+{
+    rows.clear();
+    errMsg.clear();
+    lua_State *recentStack = getRecentStack();
+    if(!recentStack)
+    {
+        errMsg = "No stack?!";
+        return false;
+    }
+    int top = lua_gettop(recentStack);
+    QByteArray btable = table.toLocal8Bit();
+    lua_getglobal(recentStack, "getNumberOf");
+    lua_pushlstring(recentStack, btable.constData(), btable.size());
+    if(lua_pcall(recentStack, 1, 1, 0))
+    {
+        errMsg = QString::fromLocal8Bit(lua_tostring(recentStack, -1));
+        lua_settop(recentStack, top);
+        return false;
+    }
+    int n = (int)lua_tointeger(recentStack, -1);
+    lua_settop(recentStack, top);
+    if(n <= 0)
+        return true;
+    QStringList keys = flt.keys();
+    QList<int> found;
+    bool searched = false;
+    if(!keys.isEmpty())
+    {
+        lua_getglobal(recentStack, "SearchItems");
+        if(lua_isfunction(recentStack, -1))
+        {
+            QByteArray bkeys = keys.join(",").toLocal8Bit();
+            lua_pushlstring(recentStack, btable.constData(), btable.size());
+            lua_pushinteger(recentStack, 0);
+            lua_pushinteger(recentStack, n - 1);
+            lua_pushlightuserdata(recentStack, const_cast<RowFilter *>(&flt));
+            lua_pushlightuserdata(recentStack, &keys);
+            lua_pushcclosure(recentStack, searchItemsPredicate, 2);
+            lua_pushlstring(recentStack, bkeys.constData(), bkeys.size());
+            if(!lua_pcall(recentStack, 5, 1, 0))
+            {
+                searched = true;
+                if(lua_istable(recentStack, -1))
+                {
+                    int i, cnt = (int)luaL_len(recentStack, -1);
+                    for(i=1; i<=cnt; i++)
+                    {
+                        lua_rawgeti(recentStack, -1, i);
+                        found.append((int)lua_tointeger(recentStack, -1));
+                        lua_pop(recentStack, 1);
+                    }
+                }
+            }
+        }
+        //SearchItems нет или он упал - перебираем строки сами
+        lua_settop(recentStack, top);
+    }
+    lua_getglobal(recentStack, "getItem");
+    if(!lua_isfunction(recentStack, -1))
+    {
+        lua_settop(recentStack, top);
+        errMsg = "getItem is not a function";
+        return false;
+    }
+    int fidx = lua_gettop(recentStack);
+    //при проекции разбираем только её поля и поля фильтра
+    QStringList readFields;
+    if(!fields.isEmpty())
+    {
+        readFields = fields;
+        foreach (QString k, keys)
+        {
+            if(!readFields.contains(k))
+                readFields.append(k);
+        }
+    }
+    int i, cnt = searched ? found.count() : n;
+    QVariantMap row;
+    for(i=0; i<cnt; i++)
+    {
+        if(limit > 0 && rows.count() >= limit)
+            break;
+        lua_pushvalue(recentStack, fidx);
+        lua_pushlstring(recentStack, btable.constData(), btable.size());
+        lua_pushinteger(recentStack, searched ? found.at(i) : i);
+        if(lua_pcall(recentStack, 2, 1, 0))
+        {
+            errMsg = QString::fromLocal8Bit(lua_tostring(recentStack, -1));
+            lua_settop(recentStack, top);
+            return false;
+        }
+        if(!lua_istable(recentStack, -1))
+        {
+            lua_pop(recentStack, 1);
+            continue;
+        }
+        if(readFields.isEmpty())
+            row = popVariantFromLuaStack(recentStack).toMap();
+        else
+        {
+            extractProjectedTable(recentStack, lua_gettop(recentStack), readFields, row);
+            lua_pop(recentStack, 1);
+        }
+        if(!searched && !flt.match(row))
+            continue;
+        if(!fields.isEmpty() && readFields.count() != fields.count())
+        {
+            QVariantMap prj;
+            foreach (QString fname, fields)
+            {
+                if(row.contains(fname))
+                    prj.insert(fname, row.value(fname));
+            }
+            row = prj;
+        }
+        rows.append(row);
+    }
+    lua_settop(recentStack, top);
+    return true;
+}
+
 static int universalCallbackHandler(JumpTableItem *jitem, lua_State *l)
 {
     QVariantList args;
@@ -711,8 +1064,28 @@ static int universalCallbackHandler(JumpTableItem *jitem, lua_State *l)
     int i;
     //qDebug() << "universalCallbackHandler: start";
     int top = lua_gettop(l);
+    CallbackDispatch dispatch;
+    dispatch.entryNs = monotonicNs();
+    int projectedArg = 0;
+    if(!jitem->fName.isEmpty())
+    {
+        //фильтры подписчиков проверяем прямо по таблице на стеке, до маршаллинга
+        if(!qqBridge->prefilterCallback(jitem->fName, l, top, dispatch))
+        {
+            setRecentStack(l);
+            return 0;
+        }
+        if(dispatch.filtered && !dispatch.fields.isEmpty())
+            projectedArg = findFirstTableArgument(l, top);
+    }
     for(i = 1; i <= top; i++)
     {
+        if(i == projectedArg)
+        {
+            extractProjectedTable(l, i, dispatch.fields, mv);
+            args.append(QVariant(mv));
+            continue;
+        }
         int vtp = extractValueFromLuaStack(l, i, sv, lv, mv);
         if(!vtp)
         {
@@ -731,6 +1104,7 @@ static int universalCallbackHandler(JumpTableItem *jitem, lua_State *l)
         }
     }
     setRecentStack(l);
+    dispatch.parsedNs = monotonicNs();
     if(jitem->fName.isEmpty())
     {
         if(jitem->owner)
@@ -740,7 +1114,7 @@ static int universalCallbackHandler(JumpTableItem *jitem, lua_State *l)
     }
     else
     {
-        qqBridge->callbackRequest(jitem->fName, args, vres);
+        qqBridge->callbackRequest(jitem->fName, args, vres, &dispatch);
     }
     int rescnt = 0;
     if(!vres.isNull())
@@ -4,12 +4,18 @@
 #include <QString>
 #include <QVariant>
 #include <QVariantList>
+#include <QStringList>
 #include <lua.hpp>
+#include "rowfilter.h"
 
 int luaopenImp(lua_State *l);
 bool getQuikVariable(QString varname, QVariant &res);
 bool invokeQuik(QString method, const QVariantList &args, QVariantList &res, QString &errMsg);
 bool invokeQuikObject(int objid, QString method, const QVariantList &args, QVariantList &res, QString &errMsg);
+bool invokeQuikObjectRange(int objid, const QStringList &methods, int from, int &to, int maxCount, QList<QVariantList> &columns, QString &errMsg);
+bool invokeQuikBatch(QString method, const QList<QVariantList> &argsList, QVariantList &res, QString &errMsg);
+bool fetchQuikParams(QString cls, QString sec, const QStringList &params, QVariantList &values, QString &errMsg);
+bool queryQuikTable(QString table, const RowFilter &flt, const QStringList &fields, int limit, QList<QVariantMap> &rows, QString &errMsg);
 void deleteQuikObject(int objid);
 bool registerNamedCallback(QString cbName);
 void unregisterAllNamedCallbacks();
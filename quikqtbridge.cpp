@@ -34,6 +34,52 @@ void QuikQtBridge::invokeObjectMethod(int objid, QString method, const QVariantL
         errOut->sendStderrLine(errMsg);
 }
 
+bool QuikQtBridge::invokeObjectMethodRange(int objid, const QStringList &methods, int from, int &to, int maxCount, QList<QVariantList> &columns, QuikCallbackHandler *errOut, QString *errText)
+{
+    QString errMsg;
+    if(!invokeQuikObjectRange(objid, methods, from, to, maxCount, columns, errMsg))
+    {
+        errOut->sendStderrLine(errMsg);
+        if(errText)
+            *errText = errMsg;
+        return false;
+    }
+    return true;
+}
+
+bool QuikQtBridge::invokeMethodBatch(QString method, const QList<QVariantList> &argsList, QVariantList &res, QuikCallbackHandler *errOut)
+{
+    QString errMsg;
+    if(!invokeQuikBatch(method, argsList, res, errMsg))
+    {
+        errOut->sendStderrLine(errMsg);
+        return false;
+    }
+    return true;
+}
+
+bool QuikQtBridge::queryTable(QString table, const RowFilter &flt, const QStringList &fields, int limit, QList<QVariantMap> &rows, QuikCallbackHandler *errOut)
+{
+    QString errMsg;
+    if(!queryQuikTable(table, flt, fields, limit, rows, errMsg))
+    {
+        errOut->sendStderrLine(errMsg);
+        return false;
+    }
+    return true;
+}
+
+bool QuikQtBridge::fetchParams(QString cls, QString sec, const QStringList &params, QVariantList &values, QuikCallbackHandler *errOut)
+{
+    QString errMsg;
+    if(!fetchQuikParams(cls, sec, params, values, errMsg))
+    {
+        errOut->sendStderrLine(errMsg);
+        return false;
+    }
+    return true;
+}
+
 void QuikQtBridge::deleteObject(int objid)
 {
     deleteQuikObject(objid);
@@ -69,19 +115,61 @@ void QuikQtBridge::setRecentStack(Qt::HANDLE ctid, lua_State *l)
     recentStackMap.insert(ctid, l);
 }
 
-void QuikQtBridge::callbackRequest(QString name, const QVariantList &args, QVariant &vres)
+void QuikQtBridge::callbackRequest(QString name, const QVariantList &args, QVariant &vres, const CallbackDispatch *dispatch)
 {
 #ifdef QT_DEBUG
     qDebug() << "callbackRequest:" << name;
 #endif
     if(m_handlers.contains(name))
     {
-        m_handlers.value(name)->callbackRequest(name, args, vres);
+        m_handlers.value(name)->callbackRequest(name, args, vres, dispatch);
+    }
+}
+
+void QuikQtBridge::setCallbackFilters(QString name, const CallbackFilterList &filters)
+{
+    QSharedPointer<CallbackFilterList> flist(new CallbackFilterList(filters));
+    filtersMutex.lock();
+    m_filters.insert(name, flist);
+    filtersMutex.unlock();
+}
+
+bool QuikQtBridge::prefilterCallback(QString name, lua_State *l, int top, CallbackDispatch &dispatch)
+{
+    //OnParam/OnQuote приходят на каждое изменение по любой бумаге терминала,
+    //поэтому неинтересные бумаги отсекаем без блокировок и до разбора аргументов
+    SecurityInterestSet *interest = m_interest.loadAcquire();
+    if(interest)
+    {
+        if(name == "OnParam" || name == "OnQuote")
+        {
+            dispatch.filtered = false;
+            return interest->contains((name == "OnParam") ? SecurityInterestSet::Params : SecurityInterestSet::Quotes, l, top);
+        }
+    }
+    //Список фильтров берём под мьютексом, а проверяем уже без него:
+    //замена списка из потока сервера не трогает копию, которую мы держим
+    QSharedPointer<CallbackFilterList> flist;
+    filtersMutex.lock();
+    if(m_filters.contains(name))
+        flist = m_filters.value(name);
+    filtersMutex.unlock();
+    if(flist.isNull())
+    {
+        dispatch.filtered = false;
+        return true;
     }
+    return matchCallbackFilters(*flist, l, top, dispatch);
+}
+
+void QuikQtBridge::setSecurityInterest(SecurityInterestSet *interest)
+{
+    m_interest.storeRelease(interest);
 }
 
 QuikQtBridge::QuikQtBridge()
-    : QObject()
+    : QObject(),
+      m_interest(nullptr)
 {
 
 }
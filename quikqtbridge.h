@@ -4,12 +4,17 @@
 #include <QObject>
 #include <QMap>
 #include <QString>
+#include <QMutex>
+#include <QSharedPointer>
 #include <lua.hpp>
+#include "callbackfilter.h"
+#include "securityinterestset.h"
+#include "rowfilter.h"
 
 class QuikCallbackHandler
 {
 public:
-    virtual void callbackRequest(QString name, const QVariantList &args, QVariant &vres) = 0;
+    virtual void callbackRequest(QString name, const QVariantList &args, QVariant &vres, const CallbackDispatch *dispatch) = 0;
     virtual void fastCallbackRequest(void *data, const QVariantList &args, QVariant &res) = 0;
     virtual void clearFastCallbackData(void *data) = 0;
     virtual void sendStdoutLine(QString line) = 0;
@@ -41,16 +46,27 @@ public:
 
     void invokeMethod(QString method, const QVariantList &args, QVariantList &res, QuikCallbackHandler *errOut);
     void invokeObjectMethod(int objid, QString method, const QVariantList &args, QVariantList &res, QuikCallbackHandler *errOut);
+    bool invokeObjectMethodRange(int objid, const QStringList &methods, int from, int &to, int maxCount, QList<QVariantList> &columns, QuikCallbackHandler *errOut, QString *errText = nullptr);
+    bool invokeMethodBatch(QString method, const QList<QVariantList> &argsList, QVariantList &res, QuikCallbackHandler *errOut);
+    bool fetchParams(QString cls, QString sec, const QStringList &params, QVariantList &values, QuikCallbackHandler *errOut);
+    bool queryTable(QString table, const RowFilter &flt, const QStringList &fields, int limit, QList<QVariantMap> &rows, QuikCallbackHandler *errOut);
     void deleteObject(int objid);
     bool registerCallback(QuikCallbackHandler *handler, QString name);
     void getVariable(QString varname, QVariant &res);
 
     lua_State *getRecentStackForThreadId(Qt::HANDLE ctid);
     void setRecentStack(Qt::HANDLE ctid, lua_State *l);
-    void callbackRequest(QString name, const QVariantList &args, QVariant &vres);
+    void callbackRequest(QString name, const QVariantList &args, QVariant &vres, const CallbackDispatch *dispatch = nullptr);
+
+    void setCallbackFilters(QString name, const CallbackFilterList &filters);
+    bool prefilterCallback(QString name, lua_State *l, int top, CallbackDispatch &dispatch);
+    void setSecurityInterest(SecurityInterestSet *interest);
 private:
     static QuikQtBridge *global_bridge;
     QMap<QString, QuikCallbackHandler *> m_handlers;
+    QMap<QString, QSharedPointer<CallbackFilterList> > m_filters;
+    QMutex filtersMutex;
+    QAtomicPointer<SecurityInterestSet> m_interest;
     QMap<Qt::HANDLE, lua_State *> recentStackMap;
 
     explicit QuikQtBridge();
@@ -0,0 +1,207 @@
+#include "quotebook.h"
+#include <QHash>
+#include <QtMath>
+
+QuoteBook::QuoteBook()
+    : valid(false)
+{
+}
+
+void QuoteBook::assign(const QVariantMap &level2, int scale)
+{
+    scale = qMax(0, scale);
+    parseSide(level2.value("bid"), scale, bids);
+    parseSide(level2.value("offer"), scale, offers);
+    valid = true;
+}
+
+void QuoteBook::clear()
+{
+    bids.clear();
+    offers.clear();
+    valid = false;
+}
+
+bool QuoteBook::decimalMantissa(const QString &value, int scale, qint64 &res, bool *exact)
+{
+    QString s = value.trimmed();
+    int i = 0, n = s.length();
+    bool neg = false;
+    if(i < n && (s.at(i) == '-' || s.at(i) == '+'))
+        neg = (s.at(i++) == '-');
+    qint64 m = 0;
+    int digits = 0, fracDigits = 0;
+    bool dot = false, roundUp = false, lost = false;
+    for(; i<n; i++)
+    {
+        QChar c = s.at(i);
+        if(c == '.' && !dot)
+        {
+            dot = true;
+            continue;
+        }
+        if(!c.isDigit())
+            return false;
+        int d = c.digitValue();
+        digits++;
+        if(dot && fracDigits >= scale)
+        {
+            //знаки дальше scale: первый решает округление, остальные только проверяются на ноль
+            if(fracDigits == scale)
+                roundUp = (d >= 5);
+            if(d)
+                lost = true;
+            fracDigits++;
+            continue;
+        }
+        if(m > (Q_INT64_C(0x7FFFFFFFFFFFFFFF) - d) / 10)
+            return false;
+        m = m * 10 + d;
+        if(dot)
+            fracDigits++;
+    }
+    if(!digits)
+        return false;
+    for(int k=qMin(fracDigits, scale); k<scale; k++)
+    {
+        if(m > Q_INT64_C(0x7FFFFFFFFFFFFFFF) / 10)
+            return false;
+        m *= 10;
+    }
+    if(roundUp)
+    {
+        if(m == Q_INT64_C(0x7FFFFFFFFFFFFFFF))
+            return false;
+        m++;
+    }
+    res = neg ? -m : m;
+    if(exact)
+        *exact = !lost;
+    return true;
+}
+
+void QuoteBook::parseSide(const QVariant &side, int scale, QVector<Level> &levels)
+{
+    levels.clear();
+    QVariantList lst = side.toList();
+    levels.reserve(lst.count());
+    int i;
+    for(i=0; i<lst.count(); i++)
+    {
+        QVariantMap lvl = lst.at(i).toMap();
+        Level l;
+        l.price = lvl.value("price").toString();
+        l.qty = lvl.value("quantity").toString();
+        //строки не в десятичной записи (например, с экспонентой) разбираются через double
+        if(!decimalMantissa(l.price, scale, l.priceNum))
+            l.priceNum = qRound64(l.price.toDouble() * qPow(10.0, scale));
+        if(!decimalMantissa(l.qty, 0, l.qtyNum, &l.qtyIsInt))
+        {
+            double qty = l.qty.toDouble();
+            l.qtyNum = qRound64(qty);
+            l.qtyIsInt = ((double)l.qtyNum == qty);
+        }
+        if(!l.price.isEmpty())
+            levels.append(l);
+    }
+}
+
+QuoteBook QuoteBook::trimmed(int depth) const
+{
+    //getQuoteLevel2 отдаёт обе стороны по возрастанию цены:
+    //лучшие покупки в конце списка bid, лучшие продажи в начале offer
+    QuoteBook res;
+    res.valid = valid;
+    if(depth <= 0 || bids.count() <= depth)
+        res.bids = bids;
+    else
+        res.bids = bids.mid(bids.count() - depth);
+    if(depth <= 0 || offers.count() <= depth)
+        res.offers = offers;
+    else
+        res.offers = offers.mid(0, depth);
+    return res;
+}
+
+bool QuoteBook::operator==(const QuoteBook &other) const
+{
+    return valid == other.valid && bids == other.bids && offers == other.offers;
+}
+
+QJsonArray QuoteBook::levelJson(const Level &l, bool numeric)
+{
+    if(numeric)
+        return QJsonArray{l.priceNum, l.qtyIsInt ? QJsonValue(l.qtyNum) : QJsonValue(l.qty)};
+    return QJsonArray{l.price, l.qty};
+}
+
+QJsonObject QuoteBook::diffSide(const QVector<Level> &oldSide, const QVector<Level> &newSide, bool numeric)
+{
+    QHash<QString, QString> oldLevels;
+    oldLevels.reserve(oldSide.count());
+    int i;
+    for(i=0; i<oldSide.count(); i++)
+        oldLevels.insert(oldSide.at(i).price, oldSide.at(i).qty);
+    QJsonArray setLevels, delPrices;
+    for(i=0; i<newSide.count(); i++)
+    {
+        const Level &l = newSide.at(i);
+        QHash<QString, QString>::iterator it = oldLevels.find(l.price);
+        if(it != oldLevels.end())
+        {
+            bool same = (it.value() == l.qty);
+            oldLevels.erase(it);
+            if(same)
+                continue;
+        }
+        setLevels.append(levelJson(l, numeric));
+    }
+    //всё, что осталось от старого стакана, из нового ушло
+    for(i=0; i<oldSide.count(); i++)
+    {
+        if(oldLevels.contains(oldSide.at(i).price))
+        {
+            if(numeric)
+                delPrices.append(oldSide.at(i).priceNum);
+            else
+                delPrices.append(oldSide.at(i).price);
+        }
+    }
+    QJsonObject res;
+    if(!setLevels.isEmpty())
+        res.insert("set", setLevels);
+    if(!delPrices.isEmpty())
+        res.insert("del", delPrices);
+    return res;
+}
+
+QJsonObject QuoteBook::diff(const QuoteBook &newer, bool numeric) const
+{
+    QJsonObject res;
+    QJsonObject bidDiff = diffSide(bids, newer.bids, numeric);
+    if(!bidDiff.isEmpty())
+        res.insert("bid", bidDiff);
+    QJsonObject offerDiff = diffSide(offers, newer.offers, numeric);
+    if(!offerDiff.isEmpty())
+        res.insert("offer", offerDiff);
+    return res;
+}
+
+QJsonArray QuoteBook::sideJson(const QVector<Level> &side, bool numeric)
+{
+    QJsonArray res;
+    int i;
+    for(i=0; i<side.count(); i++)
+        res.append(levelJson(side.at(i), numeric));
+    return res;
+}
+
+QJsonObject QuoteBook::snapshot(bool numeric) const
+{
+    QJsonObject res
+    {
+        {"bid", sideJson(bids, numeric)},
+        {"offer", sideJson(offers, numeric)}
+    };
+    return res;
+}
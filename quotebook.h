@@ -0,0 +1,49 @@
+#ifndef QUOTEBOOK_H
+#define QUOTEBOOK_H
+
+#include <QString>
+#include <QVector>
+#include <QVariant>
+#include <QVariantMap>
+#include <QJsonObject>
+#include <QJsonArray>
+
+//Последний стакан бумаги в том виде, как его отдаёт getQuoteLevel2 (цены и объёмы строками,
+//порядок уровней квиковый). Умеет строить разницу с более новым стаканом по ценам:
+//set - новые и изменившиеся уровни [price, qty], del - исчезнувшие цены.
+//При разборе цены сразу переводятся в целые мантиссы по scale бумаги (price * 10^scale) прямо
+//из десятичной строки, без double, чтобы числовой формат не требовал разбора строк ни на сервере, ни у клиента.
+//Количество переводится в целое, только если оно целое (дробные лоты отдаются строкой как есть).
+class QuoteBook
+{
+public:
+    QuoteBook();
+    void assign(const QVariantMap &level2, int scale = 0);
+    void clear();
+    bool isValid() const {return valid;}
+    QuoteBook trimmed(int depth) const;
+    bool operator==(const QuoteBook &other) const;
+    QJsonObject diff(const QuoteBook &newer, bool numeric = false) const;
+    QJsonObject snapshot(bool numeric = false) const;
+private:
+    struct Level
+    {
+        QString price;
+        QString qty;
+        qint64 priceNum;
+        qint64 qtyNum;
+        bool qtyIsInt;
+        bool operator==(const Level &other) const {return price == other.price && qty == other.qty;}
+    };
+    QVector<Level> bids;
+    QVector<Level> offers;
+    bool valid;
+    static void parseSide(const QVariant &side, int scale, QVector<Level> &levels);
+    //десятичная строка -> value * 10^scale; лишние знаки дроби округляются, exact = false, если они не нули
+    static bool decimalMantissa(const QString &value, int scale, qint64 &res, bool *exact = nullptr);
+    static QJsonArray levelJson(const Level &l, bool numeric);
+    static QJsonObject diffSide(const QVector<Level> &oldSide, const QVector<Level> &newSide, bool numeric);
+    static QJsonArray sideJson(const QVector<Level> &side, bool numeric);
+};
+
+#endif // QUOTEBOOK_H
@@ -0,0 +1,177 @@
+#include "referencedatacache.h"
+#include <QDateTime>
+#include <algorithm>
+#include "rowfilter.h"
+
+ReferenceDataCache::ReferenceDataCache()
+    : ttlMs(0),
+      classesLoadedMs(0),
+      accValid(false),
+      hits(0),
+      misses(0),
+      lastVersion(0)
+{
+}
+
+bool ReferenceDataCache::classes(QStringList &res)
+{
+    if(classList.isEmpty() || !fresh(classesLoadedMs))
+    {
+        misses++;
+        return false;
+    }
+    hits++;
+    res = classList;
+    return true;
+}
+
+void ReferenceDataCache::setClasses(const QStringList &cl)
+{
+    classList = cl;
+    classesLoadedMs = QDateTime::currentMSecsSinceEpoch();
+}
+
+bool ReferenceDataCache::classSecurities(const QString &cls, QList<QVariantMap> &rows, quint64 *version)
+{
+    QHash<QString, Rows>::const_iterator it = secRows.constFind(cls);
+    if(it == secRows.constEnd() || !fresh(it.value().loadedMs))
+    {
+        misses++;
+        return false;
+    }
+    hits++;
+    rows = it.value().rows;
+    if(version)
+        *version = it.value().version;
+    return true;
+}
+
+quint64 ReferenceDataCache::setClassSecurities(const QString &cls, const QList<QVariantMap> &rows)
+{
+    Rows r;
+    r.rows = rows;
+    r.loadedMs = QDateTime::currentMSecsSinceEpoch();
+    r.version = ++lastVersion;
+    secRows.insert(cls, r);
+    QStringList codes;
+    int i;
+    for(i=0; i<rows.count(); i++)
+        codes.append(rows.at(i).value("code").toString());
+    setClassSecurityCodes(cls, codes);
+    return r.version;
+}
+
+bool ReferenceDataCache::classSecurityCodes(const QString &cls, QStringList &codes)
+{
+    QHash<QString, Codes>::const_iterator it = secCodes.constFind(cls);
+    if(it == secCodes.constEnd() || !fresh(it.value().loadedMs))
+    {
+        misses++;
+        return false;
+    }
+    hits++;
+    codes = it.value().codes;
+    return true;
+}
+
+void ReferenceDataCache::setClassSecurityCodes(const QString &cls, const QStringList &codes)
+{
+    Codes c;
+    c.codes = codes;
+    c.loadedMs = QDateTime::currentMSecsSinceEpoch();
+    secCodes.insert(cls, c);
+}
+
+bool ReferenceDataCache::accounts(QList<QVariantMap> &rows, quint64 *version)
+{
+    if(!accValid || !fresh(accRows.loadedMs))
+    {
+        misses++;
+        return false;
+    }
+    hits++;
+    rows = accRows.rows;
+    if(version)
+        *version = accRows.version;
+    return true;
+}
+
+quint64 ReferenceDataCache::setAccounts(const QList<QVariantMap> &rows)
+{
+    accRows = Rows();
+    accRows.rows = rows;
+    accRows.loadedMs = QDateTime::currentMSecsSinceEpoch();
+    accRows.version = ++lastVersion;
+    accValid = true;
+    return accRows.version;
+}
+
+bool ReferenceDataCache::lookupClassSecurities(const QString &cls, const QString &key, const QStringList &values, QList<int> &rowIdx)
+{
+    QHash<QString, Rows>::iterator it = secRows.find(cls);
+    if(it == secRows.end() || !fresh(it.value().loadedMs))
+        return false;
+    lookupRows(it.value(), key, values, rowIdx);
+    return true;
+}
+
+bool ReferenceDataCache::lookupAccounts(const QString &key, const QStringList &values, QList<int> &rowIdx)
+{
+    if(!accValid || !fresh(accRows.loadedMs))
+        return false;
+    lookupRows(accRows, key, values, rowIdx);
+    return true;
+}
+
+void ReferenceDataCache::lookupRows(Rows &r, const QString &key, const QStringList &values, QList<int> &rowIdx)
+{
+    QHash<QString, QHash<QString, QVector<int> > >::iterator iit = r.indexes.find(key);
+    if(iit == r.indexes.end())
+    {
+        QHash<QString, QVector<int> > idx;
+        int i;
+        for(i=0; i<r.rows.count(); i++)
+        {
+            QVariantMap::const_iterator fit = r.rows.at(i).constFind(key);
+            if(fit != r.rows.at(i).constEnd())
+                idx[RowFilter::indexValue(fit.value())].append(i);
+        }
+        iit = r.indexes.insert(key, idx);
+    }
+    rowIdx.clear();
+    foreach (QString v, values)
+    {
+        QHash<QString, QVector<int> >::const_iterator vit = iit.value().constFind(v);
+        if(vit == iit.value().constEnd())
+            continue;
+        int i;
+        for(i=0; i<vit.value().count(); i++)
+            rowIdx.append(vit.value().at(i));
+    }
+    //строки отдаются в порядке таблицы, как при полном проходе
+    if(values.count() > 1)
+        std::sort(rowIdx.begin(), rowIdx.end());
+}
+
+void ReferenceDataCache::invalidate()
+{
+    classList.clear();
+    classesLoadedMs = 0;
+    secRows.clear();
+    secCodes.clear();
+    accRows = Rows();
+    accValid = false;
+}
+
+void ReferenceDataCache::invalidateClass(const QString &cls)
+{
+    secRows.remove(cls);
+    secCodes.remove(cls);
+}
+
+bool ReferenceDataCache::fresh(qint64 loadedMs)
+{
+    if(ttlMs <= 0)
+        return true;
+    return QDateTime::currentMSecsSinceEpoch() - loadedMs < ttlMs;
+}
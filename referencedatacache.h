@@ -0,0 +1,68 @@
+#ifndef REFERENCEDATACACHE_H
+#define REFERENCEDATACACHE_H
+
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+#include <QList>
+#include <QHash>
+#include <QVector>
+
+//Кеш справочных данных терминала: список классов, коды бумаг и строки getSecurityInfo по бумагам
+//каждого класса и строки таблицы trade_accounts. Заполняется при первом обращении
+//(или фоновым прогревом), сбрасывается целиком по OnConnected/OnCleanUp и по истечении ttl.
+//Живёт только в потоке сервера, поэтому блокировок нет.
+class ReferenceDataCache
+{
+public:
+    ReferenceDataCache();
+    void setTtl(int sec) {ttlMs = (qint64)qMax(0, sec) * 1000;}
+    bool classes(QStringList &res);
+    void setClasses(const QStringList &cl);
+    //version - номер загрузки строк: меняется при каждом перечитывании, по нему проверяются курсоры
+    bool classSecurities(const QString &cls, QList<QVariantMap> &rows, quint64 *version = nullptr);
+    quint64 setClassSecurities(const QString &cls, const QList<QVariantMap> &rows);
+    //коды бумаг класса (getClassSecurities); заполняются и вместе со строками класса
+    bool classSecurityCodes(const QString &cls, QStringList &codes);
+    void setClassSecurityCodes(const QString &cls, const QStringList &codes);
+    bool accounts(QList<QVariantMap> &rows, quint64 *version = nullptr);
+    quint64 setAccounts(const QList<QVariantMap> &rows);
+    //номера строк (по возрастанию), у которых поле key равно одному из values;
+    //индекс по полю строится при первом обращении. false - данных нет в кеше
+    bool lookupClassSecurities(const QString &cls, const QString &key, const QStringList &values, QList<int> &rowIdx);
+    bool lookupAccounts(const QString &key, const QStringList &values, QList<int> &rowIdx);
+    void invalidate();
+    void invalidateClass(const QString &cls);
+    quint64 hitsCount() const {return hits;}
+    quint64 missesCount() const {return misses;}
+    int cachedClassesCount() const {return secRows.count();}
+private:
+    struct Rows
+    {
+        QList<QVariantMap> rows;
+        qint64 loadedMs;
+        quint64 version;
+        QHash<QString, QHash<QString, QVector<int> > > indexes;
+        Rows() : loadedMs(0), version(0){}
+    };
+    qint64 ttlMs;
+    QStringList classList;
+    qint64 classesLoadedMs;
+    QHash<QString, Rows> secRows;
+    struct Codes
+    {
+        QStringList codes;
+        qint64 loadedMs;
+        Codes() : loadedMs(0){}
+    };
+    QHash<QString, Codes> secCodes;
+    Rows accRows;
+    bool accValid;
+    quint64 hits;
+    quint64 misses;
+    quint64 lastVersion;
+    bool fresh(qint64 loadedMs);
+    static void lookupRows(Rows &r, const QString &key, const QStringList &values, QList<int> &rowIdx);
+};
+
+#endif // REFERENCEDATACACHE_H
@@ -0,0 +1,280 @@
+#include "referencedatasnapshot.h"
+#include <QCborValue>
+#include <QCborArray>
+#include <QCborMap>
+#include <QCryptographicHash>
+#include <QtEndian>
+#include <QSet>
+#include <QSaveFile>
+#include <cstring>
+
+//заголовок файла: сигнатура, версия формата, длина оглавления; затем оглавление (CBOR) и строки классов
+static const char snapshotMagic[4] = {'Q', 'Q', 'R', 'D'};
+#define SNAPSHOT_FORMAT_VERSION 1
+#define SNAPSHOT_HEADER_SIZE    12
+
+ReferenceDataSnapshot::ReferenceDataSnapshot()
+    : mapped(nullptr),
+      mappedSize(0),
+      dirty(false)
+{
+}
+
+ReferenceDataSnapshot::~ReferenceDataSnapshot()
+{
+    unmapFile();
+}
+
+bool ReferenceDataSnapshot::open(const QString &filePath)
+{
+    unmapFile();
+    path = filePath;
+    classList.clear();
+    classListHash.clear();
+    entries.clear();
+    dirty = false;
+    if(!mapFile())
+        return false;
+    if(!readToc())
+    {
+        unmapFile();
+        classList.clear();
+        classListHash.clear();
+        entries.clear();
+        return false;
+    }
+    return true;
+}
+
+QByteArray ReferenceDataSnapshot::listHash(const QString &list)
+{
+    //порядок в ответе терминала не гарантирован, поэтому хешируется отсортированный список
+    QStringList items = list.split(",", Qt::SkipEmptyParts);
+    items.sort();
+    return QCryptographicHash::hash(items.join(",").toUtf8(), QCryptographicHash::Sha1);
+}
+
+void ReferenceDataSnapshot::setClasses(const QStringList &cl, const QByteArray &hash)
+{
+    if(cl == classList && hash == classListHash)
+        return;
+    classList = cl;
+    classListHash = hash;
+    dirty = true;
+}
+
+bool ReferenceDataSnapshot::classSecurities(const QString &cls, const QByteArray &hash, QList<QVariantMap> &rows) const
+{
+    QMap<QString, Entry>::const_iterator it = entries.constFind(cls);
+    if(it == entries.constEnd())
+        return false;
+    if(!hash.isEmpty() && hash != it.value().hash)
+        return false;
+    QByteArray data = entryData(it.value());
+    if(data.isEmpty())
+        return false;
+    QCborParserError err;
+    QCborValue v = QCborValue::fromCbor(data, &err);
+    if(err.error != QCborError::NoError || !v.isArray())
+        return false;
+    QCborArray arr = v.toArray();
+    rows.clear();
+    int i;
+    for(i=0; i<arr.size(); i++)
+        rows.append(arr.at(i).toMap().toVariantMap());
+    return true;
+}
+
+QByteArray ReferenceDataSnapshot::classSecuritiesHash(const QString &cls) const
+{
+    return entries.value(cls).hash;
+}
+
+void ReferenceDataSnapshot::setClassSecurities(const QString &cls, const QByteArray &hash, const QList<QVariantMap> &rows)
+{
+    QCborArray arr;
+    int i;
+    for(i=0; i<rows.count(); i++)
+        arr.append(QCborMap::fromVariantMap(rows.at(i)));
+    Entry &e = entries[cls];
+    e.hash = hash;
+    e.offset = -1;
+    e.size = 0;
+    e.pending = QCborValue(arr).toCbor();
+    e.trusted = false;
+    dirty = true;
+}
+
+void ReferenceDataSnapshot::removeClass(const QString &cls)
+{
+    if(entries.remove(cls))
+        dirty = true;
+}
+
+bool ReferenceDataSnapshot::isTrusted(const QString &cls) const
+{
+    QMap<QString, Entry>::const_iterator it = entries.constFind(cls);
+    return it != entries.constEnd() && it.value().trusted;
+}
+
+void ReferenceDataSnapshot::distrust(const QString &cls)
+{
+    QMap<QString, Entry>::iterator it = entries.find(cls);
+    if(it != entries.end())
+        it.value().trusted = false;
+}
+
+void ReferenceDataSnapshot::distrustAll()
+{
+    QMap<QString, Entry>::iterator it;
+    for(it=entries.begin(); it!=entries.end(); ++it)
+        it.value().trusted = false;
+}
+
+bool ReferenceDataSnapshot::save()
+{
+    if(path.isEmpty())
+        return false;
+    QByteArray blobs;
+    QCborArray jentries;
+    QSet<QString> trusted;
+    QMap<QString, Entry>::const_iterator it;
+    for(it=entries.constBegin(); it!=entries.constEnd(); ++it)
+    {
+        QByteArray data = entryData(it.value());
+        if(data.isEmpty())
+            continue;
+        QCborMap je;
+        je.insert(QString("class"), it.key());
+        je.insert(QString("hash"), it.value().hash);
+        je.insert(QString("offset"), (qint64)blobs.size());
+        je.insert(QString("size"), (qint64)data.size());
+        jentries.append(je);
+        blobs.append(data);
+        if(it.value().trusted)
+            trusted.insert(it.key());
+    }
+    QCborMap toc;
+    toc.insert(QString("classes"), QCborArray::fromStringList(classList));
+    toc.insert(QString("classesHash"), classListHash);
+    toc.insert(QString("entries"), jentries);
+    QByteArray tocData = QCborValue(toc).toCbor();
+    uchar header[SNAPSHOT_HEADER_SIZE];
+    memcpy(header, snapshotMagic, 4);
+    qToLittleEndian<quint32>(SNAPSHOT_FORMAT_VERSION, header + 4);
+    qToLittleEndian<quint32>((quint32)tocData.size(), header + 8);
+    //QSaveFile пишет во временный файл рядом и заменяет старый одним переименованием:
+    //при сбое на диске остаётся либо старый, либо новый снимок целиком
+    QSaveFile sf(path);
+    if(!sf.open(QIODevice::WriteOnly))
+        return false;
+    bool ok = (sf.write((const char *)header, SNAPSHOT_HEADER_SIZE) == SNAPSHOT_HEADER_SIZE);
+    ok = ok && sf.write(tocData) == tocData.size();
+    ok = ok && sf.write(blobs) == blobs.size();
+    if(!ok)
+    {
+        sf.cancelWriting();
+        sf.commit();
+        return false;
+    }
+    //отображённый файл нельзя заменить, пока он открыт
+    unmapFile();
+    bool committed = sf.commit();
+    if(!committed || !mapFile() || !readToc())
+    {
+        //данные остаются в памяти и уйдут на диск при следующей записи;
+        //если замена не удалась, старый файл цел и снова отображается
+        unmapFile();
+        if(!committed)
+            mapFile();
+        int i;
+        for(i=0; i<jentries.size(); i++)
+        {
+            QCborMap je = jentries.at(i).toMap();
+            Entry &e = entries[je.value(QString("class")).toString()];
+            e.pending = blobs.mid((int)je.value(QString("offset")).toInteger(), (int)je.value(QString("size")).toInteger());
+            e.offset = -1;
+        }
+        return false;
+    }
+    QMap<QString, Entry>::iterator eit;
+    for(eit=entries.begin(); eit!=entries.end(); ++eit)
+        eit.value().trusted = trusted.contains(eit.key());
+    dirty = false;
+    return true;
+}
+
+bool ReferenceDataSnapshot::mapFile()
+{
+    file.setFileName(path);
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+    mappedSize = file.size();
+    mapped = (mappedSize > 0) ? file.map(0, mappedSize) : nullptr;
+    if(!mapped)
+    {
+        file.close();
+        mappedSize = 0;
+        return false;
+    }
+    return true;
+}
+
+void ReferenceDataSnapshot::unmapFile()
+{
+    if(mapped)
+        file.unmap(mapped);
+    mapped = nullptr;
+    mappedSize = 0;
+    if(file.isOpen())
+        file.close();
+}
+
+bool ReferenceDataSnapshot::readToc()
+{
+    if(mappedSize < SNAPSHOT_HEADER_SIZE || memcmp(mapped, snapshotMagic, 4) != 0)
+        return false;
+    if(qFromLittleEndian<quint32>(mapped + 4) != SNAPSHOT_FORMAT_VERSION)
+        return false;
+    qint64 tocSize = qFromLittleEndian<quint32>(mapped + 8);
+    qint64 dataStart = SNAPSHOT_HEADER_SIZE + tocSize;
+    if(dataStart > mappedSize)
+        return false;
+    QCborParserError err;
+    QCborValue v = QCborValue::fromCbor(QByteArray::fromRawData((const char *)mapped + SNAPSHOT_HEADER_SIZE, (int)tocSize), &err);
+    if(err.error != QCborError::NoError || !v.isMap())
+        return false;
+    QCborMap toc = v.toMap();
+    QCborArray jclasses = toc.value(QString("classes")).toArray();
+    QStringList cl;
+    int i;
+    for(i=0; i<jclasses.size(); i++)
+        cl.append(jclasses.at(i).toString());
+    QMap<QString, Entry> loaded;
+    QCborArray jentries = toc.value(QString("entries")).toArray();
+    for(i=0; i<jentries.size(); i++)
+    {
+        QCborMap je = jentries.at(i).toMap();
+        Entry e;
+        e.trusted = true;
+        e.hash = je.value(QString("hash")).toByteArray();
+        e.offset = dataStart + je.value(QString("offset")).toInteger(-1);
+        e.size = je.value(QString("size")).toInteger(-1);
+        if(e.offset < dataStart || e.size <= 0 || e.offset + e.size > mappedSize)
+            return false;
+        loaded.insert(je.value(QString("class")).toString(), e);
+    }
+    classList = cl;
+    classListHash = toc.value(QString("classesHash")).toByteArray();
+    entries = loaded;
+    return true;
+}
+
+QByteArray ReferenceDataSnapshot::entryData(const Entry &e) const
+{
+    if(!e.pending.isEmpty())
+        return e.pending;
+    if(e.offset < 0 || !mapped)
+        return QByteArray();
+    return QByteArray::fromRawData((const char *)mapped + e.offset, (int)e.size);
+}
@@ -0,0 +1,68 @@
+#ifndef REFERENCEDATASNAPSHOT_H
+#define REFERENCEDATASNAPSHOT_H
+
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+#include <QList>
+#include <QMap>
+#include <QByteArray>
+#include <QFile>
+
+//Снимок справочных данных на диске: список классов и строки getSecurityInfo по классам.
+//Файл отображается в память, при открытии читается только оглавление, строки класса
+//разбираются (CBOR) при первом обращении. Вместе с данными хранятся хеши строк
+//getClassesList/getClassSecurities, по которым снимок сверяется с терминалом.
+//Запись идёт целиком во временный файл, который заменяет старый одним переименованием (QSaveFile).
+//Живёт только в потоке сервера.
+class ReferenceDataSnapshot
+{
+public:
+    ReferenceDataSnapshot();
+    ~ReferenceDataSnapshot();
+    //false - файла нет, он другой версии формата или повреждён; снимок тогда начинается пустым
+    bool open(const QString &filePath);
+    bool isEnabled() const {return !path.isEmpty();}
+    static QByteArray listHash(const QString &list);
+    QStringList classes() const {return classList;}
+    QByteArray classesHash() const {return classListHash;}
+    void setClasses(const QStringList &cl, const QByteArray &hash);
+    QStringList storedClasses() const {return entries.keys();}
+    int classesCount() const {return entries.count();}
+    //hash пустой - строки отдаются без сверки (только для классов, которым ещё доверяем)
+    bool classSecurities(const QString &cls, const QByteArray &hash, QList<QVariantMap> &rows) const;
+    QByteArray classSecuritiesHash(const QString &cls) const;
+    void setClassSecurities(const QString &cls, const QByteArray &hash, const QList<QVariantMap> &rows);
+    void removeClass(const QString &cls);
+    //строкам класса, прочитанным из файла, доверяют до фоновой сверки или сброса кеша;
+    //после этого они отдаются только при совпадении хеша списка бумаг
+    bool isTrusted(const QString &cls) const;
+    void distrust(const QString &cls);
+    void distrustAll();
+    bool isDirty() const {return dirty;}
+    bool save();
+private:
+    struct Entry
+    {
+        QByteArray hash;
+        qint64 offset;   //смещение строк в отображённом файле, -1 - строки ещё не записаны
+        qint64 size;
+        QByteArray pending;
+        bool trusted;
+        Entry() : offset(-1), size(0), trusted(false){}
+    };
+    QString path;
+    QFile file;
+    uchar *mapped;
+    qint64 mappedSize;
+    QStringList classList;
+    QByteArray classListHash;
+    QMap<QString, Entry> entries;
+    bool dirty;
+    bool mapFile();
+    void unmapFile();
+    bool readToc();
+    QByteArray entryData(const Entry &e) const;
+};
+
+#endif // REFERENCEDATASNAPSHOT_H
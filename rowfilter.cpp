@@ -0,0 +1,319 @@
+#include "rowfilter.h"
+#include <QJsonObject>
+#include <QJsonArray>
+
+static bool variantNumber(const QVariant &v, double &res)
+{
+    return RowFilter::numberValue(v, res);
+}
+
+bool RowFilter::numberValue(const QVariant &v, double &res)
+{
+    switch((int)v.type())
+    {
+    case QVariant::Int:
+    case QVariant::UInt:
+    case QVariant::LongLong:
+    case QVariant::ULongLong:
+    case QVariant::Double:
+        res = v.toDouble();
+        return true;
+    case QVariant::String:
+    {
+        bool ok;
+        res = v.toString().toDouble(&ok);
+        return ok;
+    }
+    case QVariant::Map:
+    {
+        QVariantMap dt = v.toMap();
+        if(!dt.contains("year") || !dt.contains("month") || !dt.contains("day"))
+            return false;
+        res = ((((dt.value("year").toLongLong() * 100 + dt.value("month").toLongLong()) * 100 + dt.value("day").toLongLong()) * 100
+                + dt.value("hour").toLongLong()) * 100 + dt.value("min").toLongLong()) * 100 + dt.value("sec").toLongLong();
+        res += dt.value("ms").toDouble() / 1000.0;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+//значение поля числовое по типу (строка с числом не считается); таблица даты/времени - тоже
+static bool numericField(const QVariant &v)
+{
+    switch((int)v.type())
+    {
+    case QVariant::Int:
+    case QVariant::UInt:
+    case QVariant::LongLong:
+    case QVariant::ULongLong:
+    case QVariant::Double:
+    case QVariant::Map:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool jsonConstant(const QJsonValue &jv, QString &sv, double &nv, bool &isNum, bool &numConst)
+{
+    if(jv.isDouble())
+    {
+        nv = jv.toDouble();
+        sv = RowFilter::indexValue(nv);
+        isNum = true;
+        numConst = true;
+        return true;
+    }
+    if(jv.isString())
+    {
+        sv = jv.toString();
+        nv = sv.toDouble(&isNum);
+        numConst = false;
+        return true;
+    }
+    return false;
+}
+
+static int compareValue(const QVariant &val, const RowPredicate &p, bool &comparable)
+{
+    double v;
+    comparable = true;
+    if(p.isNumeric && (p.numberConst || numericField(val)) && variantNumber(val, v))
+        return (v < p.numValue) ? -1 : ((v > p.numValue) ? 1 : 0);
+    if(val.type() == QVariant::String)
+        return val.toString().compare(p.strValue);
+    if(!val.canConvert<QString>())
+    {
+        comparable = false;
+        return 0;
+    }
+    return val.toString().compare(p.strValue);
+}
+
+bool RowPredicate::match(const QVariantMap &row) const
+{
+    QVariantMap::const_iterator it = row.constFind(key);
+    if(it == row.constEnd())
+        return false;
+    const QVariant &val = it.value();
+    bool comparable;
+    int cmp;
+    switch(op)
+    {
+    case Exists:
+        return true;
+    case Regexp:
+        return rexp.match(val.toString()).hasMatch();
+    case In:
+    {
+        double v;
+        if((!numValues.isEmpty() || !strNumValues.isEmpty()) && variantNumber(val, v))
+        {
+            if(numValues.contains(v) || (numericField(val) && strNumValues.contains(v)))
+                return true;
+        }
+        return strValues.contains(val.toString());
+    }
+    case Eq:
+    case Ne:
+        cmp = compareValue(val, *this, comparable);
+        return comparable && ((cmp == 0) == (op == Eq));
+    default:
+        break;
+    }
+    //для диапазонов числовая константа требует числового значения поля
+    double v;
+    if(numberConst && !variantNumber(val, v))
+        return false;
+    cmp = compareValue(val, *this, comparable);
+    if(!comparable)
+        return false;
+    switch(op)
+    {
+    case Lt:
+        return cmp < 0;
+    case Le:
+        return cmp <= 0;
+    case Gt:
+        return cmp > 0;
+    case Ge:
+        return cmp >= 0;
+    default:
+        return false;
+    }
+}
+
+bool RowFilter::parse(const QJsonValue &jfilters, QString &errMsg)
+{
+    predicates.clear();
+    if(jfilters.isUndefined() || jfilters.isNull())
+        return true;
+    if(!jfilters.isArray())
+    {
+        errMsg = "'filters' must be an array";
+        return false;
+    }
+    static const char *opNames[] = {"regexp", "eq", "ne", "in", "lt", "le", "gt", "ge"};
+    static const RowPredicate::Op ops[] = {RowPredicate::Regexp, RowPredicate::Eq, RowPredicate::Ne, RowPredicate::In,
+                                           RowPredicate::Lt, RowPredicate::Le, RowPredicate::Gt, RowPredicate::Ge};
+    QJsonArray jarr = jfilters.toArray();
+    int i, k;
+    for(i=0; i<jarr.count(); i++)
+    {
+        QJsonObject flt = jarr.at(i).toObject();
+        if(!flt.contains("key"))
+            continue;
+        QString key = flt.value("key").toString();
+        bool hasOp = false;
+        for(k=0; k<8; k++)
+        {
+            if(!flt.contains(opNames[k]))
+                continue;
+            hasOp = true;
+            RowPredicate p;
+            p.op = ops[k];
+            p.key = key;
+            QJsonValue jv = flt.value(opNames[k]);
+            if(p.op == RowPredicate::Regexp)
+            {
+                p.rexp.setPattern(jv.toString());
+                if(!p.rexp.isValid())
+                {
+                    errMsg = QString("Wrong regexp for key %1: %2").arg(key, p.rexp.errorString());
+                    return false;
+                }
+                p.rexp.optimize();
+            }
+            else if(p.op == RowPredicate::In)
+            {
+                if(!jv.isArray())
+                {
+                    errMsg = QString("'in' for key %1 must be an array").arg(key);
+                    return false;
+                }
+                QJsonArray jset = jv.toArray();
+                int j;
+                for(j=0; j<jset.count(); j++)
+                {
+                    QString sv;
+                    double nv;
+                    bool isNum, numConst;
+                    if(!jsonConstant(jset.at(j), sv, nv, isNum, numConst))
+                    {
+                        errMsg = QString("Wrong value in 'in' for key %1").arg(key);
+                        return false;
+                    }
+                    p.strValues.insert(sv);
+                    if(numConst)
+                        p.numValues.insert(nv);
+                    else if(isNum)
+                        p.strNumValues.insert(nv);
+                }
+            }
+            else if(!jsonConstant(jv, p.strValue, p.numValue, p.isNumeric, p.numberConst))
+            {
+                errMsg = QString("Wrong value of '%1' for key %2").arg(opNames[k], key);
+                return false;
+            }
+            predicates.append(p);
+        }
+        if(!hasOp)
+        {
+            RowPredicate p;
+            p.key = key;
+            predicates.append(p);
+        }
+    }
+    //регулярки - самые дорогие условия, проверяем их последними
+    QList<RowPredicate> ordered;
+    for(k=0; k<2; k++)
+    {
+        for(i=0; i<predicates.count(); i++)
+        {
+            bool isRexp = (predicates.at(i).op == RowPredicate::Regexp);
+            if(isRexp == (k == 1))
+                ordered.append(predicates.at(i));
+        }
+    }
+    predicates = ordered;
+    return true;
+}
+
+bool RowFilter::match(const QVariantMap &row) const
+{
+    int i;
+    for(i=0; i<predicates.count(); i++)
+    {
+        if(!predicates.at(i).match(row))
+            return false;
+    }
+    return true;
+}
+
+QStringList RowPredicate::fixedValues() const
+{
+    QStringList values;
+    if(op == Eq)
+        values.append(isNumeric ? RowFilter::indexValue(numValue) : strValue);
+    else if(op == In)
+    {
+        foreach (QString sv, strValues)
+        {
+            bool ok;
+            double nv = sv.toDouble(&ok);
+            QString iv = ok ? RowFilter::indexValue(nv) : sv;
+            if(!values.contains(iv))
+                values.append(iv);
+        }
+    }
+    return values;
+}
+
+QStringList RowFilter::keys() const
+{
+    QStringList res;
+    int i;
+    for(i=0; i<predicates.count(); i++)
+    {
+        if(!res.contains(predicates.at(i).key))
+            res.append(predicates.at(i).key);
+    }
+    return res;
+}
+
+bool RowFilter::indexableKey(QString &key, QStringList &values) const
+{
+    //из нескольких подходящих берём условие с наименьшим числом значений
+    int i, best = -1, bestCount = 0;
+    for(i=0; i<predicates.count(); i++)
+    {
+        const RowPredicate &p = predicates.at(i);
+        int cnt = 0;
+        if(p.op == RowPredicate::Eq)
+            cnt = 1;
+        else if(p.op == RowPredicate::In)
+            cnt = p.strValues.count();
+        else
+            continue;
+        if(best < 0 || cnt < bestCount)
+        {
+            best = i;
+            bestCount = cnt;
+        }
+    }
+    if(best < 0)
+        return false;
+    key = predicates.at(best).key;
+    values = predicates.at(best).fixedValues();
+    return true;
+}
+
+QString RowFilter::indexValue(const QVariant &v)
+{
+    double nv;
+    if(variantNumber(v, nv))
+        return QString::number(nv, 'g', 17);
+    return v.toString();
+}
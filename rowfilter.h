@@ -0,0 +1,69 @@
+#ifndef ROWFILTER_H
+#define ROWFILTER_H
+
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+#include <QList>
+#include <QSet>
+#include <QJsonValue>
+#include <QRegularExpression>
+
+//Одно условие на поле строки таблицы. Как числа значения сравниваются, только если константа
+//в запросе - число json или значение поля числовое (и второе тоже приводится к числу),
+//иначе как строки: строковая константа "0012" не равна строке "12"
+struct RowPredicate
+{
+    enum Op
+    {
+        Exists,
+        Regexp,
+        Eq,
+        Ne,
+        In,
+        Lt,
+        Le,
+        Gt,
+        Ge
+    };
+    Op op;
+    QString key;
+    QRegularExpression rexp;
+    QString strValue;
+    double numValue;
+    bool isNumeric;     //константа - число или строка с числом
+    bool numberConst;   //константа - число json
+    QSet<QString> strValues;
+    QSet<double> numValues;     //числа json из in
+    QSet<double> strNumValues;  //строки с числом из in: сравниваются как числа только с числовым полем
+    RowPredicate() : op(Exists), numValue(0), isNumeric(false), numberConst(false){}
+    bool match(const QVariantMap &row) const;
+    //нормализованные (RowFilter::indexValue) значения условия eq/in
+    QStringList fixedValues() const;
+};
+
+//Фильтр load*-запросов, разобранный один раз на запрос:
+//[{"key": "lot_size", "ge": 10}, {"key": "sec_code", "in": ["SBER", "GAZP"]}, {"key": "name", "regexp": "^Сбер"}]
+//Все условия должны выполняться. Условие только с key требует наличия поля в строке.
+class RowFilter
+{
+public:
+    RowFilter(){}
+    bool parse(const QJsonValue &jfilters, QString &errMsg);
+    bool isEmpty() const {return predicates.isEmpty();}
+    bool match(const QVariantMap &row) const;
+    const QList<RowPredicate> &conditions() const {return predicates;}
+    //поля, которые проверяет фильтр, без повторов
+    QStringList keys() const;
+    //поле с фиксированным значением (eq/in) для выборки кандидатов через индекс
+    bool indexableKey(QString &key, QStringList &values) const;
+    //нормализованное значение для индекса: числа в одной записи, чтобы 10 и "10" совпадали
+    static QString indexValue(const QVariant &v);
+    //число для сравнения: числа и строки с числом, а также таблицы даты/времени квика
+    //(year, month, day, hour, min, sec, ms) как yyyyMMddhhmmss с миллисекундами в дробной части
+    static bool numberValue(const QVariant &v, double &res);
+private:
+    QList<RowPredicate> predicates;
+};
+
+#endif // ROWFILTER_H
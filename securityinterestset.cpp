@@ -0,0 +1,64 @@
+#include "securityinterestset.h"
+
+SecurityInterestSet::SecurityInterestSet()
+    : current(nullptr),
+      readers(0)
+{
+}
+
+SecurityInterestSet::~SecurityInterestSet()
+{
+    retireMutex.lock();
+    qDeleteAll(retired);
+    retired.clear();
+    delete current.fetchAndStoreOrdered(nullptr);
+    retireMutex.unlock();
+}
+
+void SecurityInterestSet::publish(const QList<SecurityKey> &paramSecs, const QList<SecurityKey> &quoteSecs, bool passAllParams, bool passAllQuotes)
+{
+    Snapshot *s = new Snapshot();
+    int i;
+    for(i=0; i<paramSecs.count(); i++)
+        s->secs[Params][paramSecs.at(i).first.toLocal8Bit()].insert(paramSecs.at(i).second.toLocal8Bit());
+    for(i=0; i<quoteSecs.count(); i++)
+        s->secs[Quotes][quoteSecs.at(i).first.toLocal8Bit()].insert(quoteSecs.at(i).second.toLocal8Bit());
+    s->passAll[Params] = passAllParams;
+    s->passAll[Quotes] = passAllQuotes;
+    Snapshot *old = current.fetchAndStoreOrdered(s);
+    retireMutex.lock();
+    if(old)
+        retired.append(old);
+    reclaim();
+    retireMutex.unlock();
+}
+
+bool SecurityInterestSet::contains(Kind kind, lua_State *l, int top)
+{
+    readers.fetchAndAddOrdered(1);
+    Snapshot *s = current.loadAcquire();
+    bool res = true;
+    if(s && !s->passAll[kind] && top >= 2 && lua_type(l, 1) == LUA_TSTRING && lua_type(l, 2) == LUA_TSTRING)
+    {
+        size_t clen = 0, slen = 0;
+        const char *cls = lua_tolstring(l, 1, &clen);
+        const char *sec = lua_tolstring(l, 2, &slen);
+        QHash<QByteArray, QSet<QByteArray> >::const_iterator it = s->secs[kind].constFind(QByteArray::fromRawData(cls, (int)clen));
+        res = (it != s->secs[kind].constEnd() && it.value().contains(QByteArray::fromRawData(sec, (int)slen)));
+    }
+    readers.fetchAndAddOrdered(-1);
+    if(!res)
+        rejected[kind].fetchAndAddRelaxed(1);
+    return res;
+}
+
+void SecurityInterestSet::reclaim()
+{
+    //снимок уже заменён, поэтому новые читатели его не увидят;
+    //если в этот момент читателей нет, то и старых держателей нет
+    if(readers.fetchAndAddOrdered(0) == 0)
+    {
+        qDeleteAll(retired);
+        retired.clear();
+    }
+}
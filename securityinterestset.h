@@ -0,0 +1,49 @@
+#ifndef SECURITYINTERESTSET_H
+#define SECURITYINTERESTSET_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QList>
+#include <QPair>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QAtomicInteger>
+#include <lua.hpp>
+
+typedef QPair<QString, QString> SecurityKey;
+
+//Множество бумаг (класс, код), на которые есть подписки параметров или стаканов.
+//Читается из потока квика в OnParam/OnQuote прямо по строкам на стеке луа, без блокировок:
+//поток сервера публикует новый неизменяемый снимок, а старый удаляет, когда читателей не осталось.
+class SecurityInterestSet
+{
+public:
+    enum Kind
+    {
+        Params = 0,
+        Quotes = 1
+    };
+    SecurityInterestSet();
+    ~SecurityInterestSet();
+    void publish(const QList<SecurityKey> &paramSecs, const QList<SecurityKey> &quoteSecs, bool passAllParams, bool passAllQuotes);
+    bool contains(Kind kind, lua_State *l, int top);
+    quint64 rejectedCount(Kind kind) const {return rejected[kind].loadAcquire();}
+private:
+    struct Snapshot
+    {
+        QHash<QByteArray, QSet<QByteArray> > secs[2];
+        bool passAll[2];
+        Snapshot(){passAll[0] = passAll[1] = false;}
+    };
+    QAtomicPointer<Snapshot> current;
+    QAtomicInt readers;
+    QMutex retireMutex;
+    QList<Snapshot *> retired;
+    QAtomicInteger<quint64> rejected[2];
+    void reclaim();
+};
+
+#endif // SECURITYINTERESTSET_H
@@ -0,0 +1,97 @@
+#include "securityupdatequeue.h"
+#include <QVector>
+
+SecurityUpdateQueue::SecurityUpdateQueue()
+    : head(nullptr),
+      wakeupPending(0),
+      wakeups(0)
+{
+}
+
+SecurityUpdateQueue::~SecurityUpdateQueue()
+{
+    qDeleteAll(nodes);
+    nodes.clear();
+}
+
+bool SecurityUpdateQueue::markDirty(const QString &cls, const QString &sec, UpdateKind kind, qint64 entryNs)
+{
+    int ki = (kind == ParamsUpdate) ? 0 : 1;
+    events[ki].fetchAndAddRelaxed(1);
+    QString key = cls + QChar('|') + sec;
+    Node *node = nodes.value(key, nullptr);
+    if(!node)
+    {
+        node = new Node();
+        node->cls = cls;
+        node->sec = sec;
+        nodes.insert(key, node);
+    }
+    //метка ставится только первым событием из ожидающих, схлопнутые её не трогают
+    if(entryNs)
+        node->entryNs[ki].testAndSetOrdered(0, entryNs);
+    int old = node->flags.fetchAndOrOrdered(kind);
+    if(old & kind)
+        coalesced[ki].fetchAndAddRelaxed(1);
+    if(old)
+        return false; //узел уже стоит в очереди
+    Node *top;
+    do
+    {
+        top = head.loadAcquire();
+        node->next = top;
+    }
+    while(!head.testAndSetOrdered(top, node));
+    if(wakeupPending.testAndSetOrdered(0, 1))
+    {
+        wakeups.fetchAndAddRelaxed(1);
+        return true;
+    }
+    return false;
+}
+
+QList<SecurityUpdateQueue::Item> SecurityUpdateQueue::takeAll()
+{
+    QList<Item> res;
+    wakeupPending.storeRelease(0);
+    Node *node = head.fetchAndStoreAcquire(nullptr);
+    //сначала собираем цепочку целиком: после сброса флагов поток квика
+    //может снова поставить узел в очередь и переписать next
+    QVector<Node *> taken;
+    while(node)
+    {
+        taken.append(node);
+        node = node->next;
+    }
+    int i;
+    for(i=taken.count()-1; i>=0; i--)
+    {
+        Node *n = taken.at(i);
+        //метки снимаются до флагов, чтобы у помеченной бумаги метка не обнулилась;
+        //событие, пришедшее между ними, уйдёт в этом проходе, а его метка останется
+        //следующему (задержка завысится, но не потеряется)
+        qint64 pns = n->entryNs[0].fetchAndStoreOrdered(0);
+        qint64 qns = n->entryNs[1].fetchAndStoreOrdered(0);
+        int f = n->flags.fetchAndStoreOrdered(0);
+        if(!f)
+            continue;
+        Item item;
+        item.cls = n->cls;
+        item.sec = n->sec;
+        item.kinds = f;
+        item.entryNs[0] = pns;
+        item.entryNs[1] = qns;
+        res.append(item);
+    }
+    return res;
+}
+
+quint64 SecurityUpdateQueue::eventsCount(UpdateKind kind) const
+{
+    return events[(kind == ParamsUpdate) ? 0 : 1].loadAcquire();
+}
+
+quint64 SecurityUpdateQueue::coalescedCount(UpdateKind kind) const
+{
+    return coalesced[(kind == ParamsUpdate) ? 0 : 1].loadAcquire();
+}
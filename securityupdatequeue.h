@@ -0,0 +1,57 @@
+#ifndef SECURITYUPDATEQUEUE_H
+#define SECURITYUPDATEQUEUE_H
+
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QAtomicInteger>
+
+//"Грязное" множество бумаг, по которым пришли OnParam/OnQuote.
+//Поток квика помечает бумагу, поток сервера забирает все помеченные за один проход.
+//Пока бумага ждёт обработки, повторные события по ней только считаются (coalesced)
+//и не порождают ни новых элементов очереди, ни новых пробуждений потока сервера.
+class SecurityUpdateQueue
+{
+public:
+    enum UpdateKind
+    {
+        ParamsUpdate = 1,
+        QuotesUpdate = 2
+    };
+    struct Item
+    {
+        QString cls;
+        QString sec;
+        int kinds;
+        qint64 entryNs[2];  //вход в самый ранний из схлопнутых колбеков (monotonicNs), по видам
+    };
+    SecurityUpdateQueue();
+    ~SecurityUpdateQueue();
+    bool markDirty(const QString &cls, const QString &sec, UpdateKind kind, qint64 entryNs = 0);
+    QList<Item> takeAll();
+    quint64 eventsCount(UpdateKind kind) const;
+    quint64 coalescedCount(UpdateKind kind) const;
+    quint64 wakeupsCount() const {return wakeups.loadAcquire();}
+private:
+    struct Node
+    {
+        QString cls;
+        QString sec;
+        QAtomicInt flags;
+        QAtomicInteger<qint64> entryNs[2];
+        Node *next;
+        Node() : next(nullptr){}
+    };
+    //узлы создаёт только поток квика (OnParam/OnQuote приходят из его главного потока),
+    //поэтому сам словарь узлов не защищён; между потоками узлы передаются через стек head
+    QHash<QString, Node *> nodes;
+    QAtomicPointer<Node> head;
+    QAtomicInt wakeupPending;
+    QAtomicInteger<quint64> events[2];
+    QAtomicInteger<quint64> coalesced[2];
+    QAtomicInteger<quint64> wakeups;
+};
+
+#endif // SECURITYUPDATEQUEUE_H
@@ -6,6 +6,10 @@
 #include <QJsonArray>
 
 ServerConfigReader::ServerConfigReader(QString scriptPath)
+    : journalSize(0),
+      journalSpillMaxSize(0),
+      refDataTtl(0),
+      invokeRangeMax(10000)
 {
     QFileInfo fi(scriptPath);
     QString ext = fi.completeSuffix();
@@ -43,6 +47,34 @@ ServerConfigReader::ServerConfigReader(QString scriptPath)
             QString prefix = jdoc.object().value("debugLogPrefix").toString();
             debugLogPathPrefix = pathPart+prefix;
         }
+        if(jdoc.object().contains("journal"))
+        {
+            QJsonObject jrn = jdoc.object().value("journal").toObject();
+            if(jrn.contains("callbacks"))
+            {
+                QVariantList vlist = jrn.value("callbacks").toArray().toVariantList();
+                foreach (QVariant v, vlist)
+                    journalCallbacks.append(v.toString());
+            }
+            else
+                journalCallbacks << "OnTrade" << "OnOrder" << "OnStopOrder" << "OnTransReply";
+            journalSize = jrn.value("size").toInt(10000);
+            if(jrn.contains("spillPrefix"))
+                journalSpillPath = pathPart + jrn.value("spillPrefix").toString() + ".jrn";
+            journalSpillMaxSize = (qint64)jrn.value("spillMaxMb").toInt(64) * 1024 * 1024;
+        }
+        if(jdoc.object().contains("referenceData"))
+        {
+            QJsonObject rd = jdoc.object().value("referenceData").toObject();
+            refDataTtl = rd.value("ttlSec").toInt(0);
+            QVariantList vlist = rd.value("preload").toArray().toVariantList();
+            foreach (QVariant v, vlist)
+                refDataPreload.append(v.toString());
+            if(rd.contains("snapshotPrefix"))
+                refDataSnapshotPath = pathPart + rd.value("snapshotPrefix").toString() + ".rds";
+        }
+        if(jdoc.object().contains("invokeRangeMax"))
+            invokeRangeMax = jdoc.object().value("invokeRangeMax").toInt(10000);
         if(jdoc.object().contains("host"))
         {
             QString hname = jdoc.object().value("host").toString().toLower();
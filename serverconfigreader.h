@@ -15,12 +15,28 @@ public:
     int getPort(){return port;}
     QString getLogPathPrefix(){return logPathPrefix;}
     QString getDebugLogPathPrefix(){return debugLogPathPrefix;}
+    QStringList getJournalCallbacks(){return journalCallbacks;}
+    int getJournalSize(){return journalSize;}
+    QString getJournalSpillPath(){return journalSpillPath;}
+    qint64 getJournalSpillMaxSize(){return journalSpillMaxSize;}
+    int getReferenceDataTtl(){return refDataTtl;}
+    QStringList getReferenceDataPreload(){return refDataPreload;}
+    QString getReferenceDataSnapshotPath(){return refDataSnapshotPath;}
+    int getInvokeRangeMax(){return invokeRangeMax;}
 private:
     QStringList allowedIPs;
     QHostAddress host;
     int port;
     QString logPathPrefix;
     QString debugLogPathPrefix;
+    QStringList journalCallbacks;
+    int journalSize;
+    QString journalSpillPath;
+    qint64 journalSpillMaxSize;
+    int refDataTtl;
+    QStringList refDataPreload;
+    QString refDataSnapshotPath;
+    int invokeRangeMax;
 };
 
 #endif // SERVERCONFIGREADER_H
@@ -0,0 +1,308 @@
+#include "subscriptionindex.h"
+
+SymbolTable::SymbolTable(int idBits)
+    : maxId((1u << idBits) - 2)
+{
+    names.append(QString());
+}
+
+quint32 SymbolTable::intern(const QString &name)
+{
+    quint32 id = ids.value(name, 0);
+    if(id)
+        return id;
+    //при переполнении разрядов ключа имя не интернируется
+    if((quint32)names.count() > maxId)
+        return 0;
+    id = (quint32)names.count();
+    names.append(name);
+    ids.insert(name, id);
+    return id;
+}
+
+quint32 SymbolTable::find(const QString &name) const
+{
+    return ids.value(name, 0);
+}
+
+QString SymbolTable::name(quint32 id) const
+{
+    if(id >= (quint32)names.count())
+        return QString();
+    return names.at(id);
+}
+
+ParamConsumer *ParamEntry::findConsumer(ConnectionData *cd) const
+{
+    int i;
+    for(i=0; i<consumers.count(); i++)
+    {
+        if(consumers.at(i)->cd == cd)
+            return consumers.at(i);
+    }
+    return nullptr;
+}
+
+bool ParamConsumer::passesDeadband(const QVariant &value) const
+{
+    if(deadband <= 0 && deadbandRel <= 0)
+        return true;
+    if(!lastSentValue.isValid())
+        return true;
+    bool newOk, oldOk;
+    double nv = value.toDouble(&newOk);
+    double ov = lastSentValue.toDouble(&oldOk);
+    if(!newOk || !oldOk)
+        return value != lastSentValue;
+    double threshold = qMax(deadband, deadbandRel * qAbs(ov));
+    return qAbs(nv - ov) >= threshold;
+}
+
+QuoteConsumer *SecurityEntry::findQuoteConsumer(ConnectionData *cd) const
+{
+    int i;
+    for(i=0; i<quoteConsumers.count(); i++)
+    {
+        if(quoteConsumers.at(i)->cd == cd)
+            return quoteConsumers.at(i);
+    }
+    return nullptr;
+}
+
+SubscriptionIndex::SubscriptionIndex()
+    : classIds(24),
+      secIds(20),
+      paramIds(20),
+      readers(0)
+{
+}
+
+SubscriptionIndex::~SubscriptionIndex()
+{
+    QList<SecurityEntry *> secs = securities.values();
+    foreach (SecurityEntry *s, secs)
+    {
+        foreach (ParamEntry *p, s->params)
+        {
+            qDeleteAll(p->consumers);
+            delete p;
+        }
+        qDeleteAll(s->quoteConsumers);
+        delete s;
+    }
+    readers = 0;
+    reclaim();
+}
+
+quint64 SubscriptionIndex::findKey(const QString &cls, const QString &sec, const QString &param) const
+{
+    quint32 c = classIds.find(cls);
+    if(!c)
+        return 0;
+    quint32 s = secIds.find(sec);
+    if(!s)
+        return 0;
+    quint32 p = 0;
+    if(!param.isEmpty())
+    {
+        p = paramIds.find(param);
+        if(!p)
+            return 0;
+    }
+    return makeKey(c, s, p);
+}
+
+ParamEntry *SubscriptionIndex::findParam(const QString &cls, const QString &sec, const QString &param) const
+{
+    quint64 key = findKey(cls, sec, param);
+    if(!key || param.isEmpty())
+        return nullptr;
+    return params.find(key);
+}
+
+SecurityEntry *SubscriptionIndex::findSecurity(const QString &cls, const QString &sec) const
+{
+    quint64 key = findKey(cls, sec, QString());
+    if(!key)
+        return nullptr;
+    return securities.find(key);
+}
+
+SecurityEntry *SubscriptionIndex::internSecurity(const QString &cls, const QString &sec)
+{
+    quint32 c = classIds.intern(cls);
+    quint32 s = secIds.intern(sec);
+    if(!c || !s)
+        return nullptr;
+    quint64 key = makeKey(c, s, 0);
+    SecurityEntry *se = securities.find(key);
+    if(!se)
+    {
+        se = new SecurityEntry(key, cls, sec);
+        securities.insert(key, se);
+    }
+    return se;
+}
+
+ParamConsumer *SubscriptionIndex::addConsumer(ConnectionData *cd, QString cls, QString sec, QString param, int id)
+{
+    SecurityEntry *s = internSecurity(cls, sec);
+    quint32 pid = paramIds.intern(param);
+    if(!s || !pid)
+        return nullptr;
+    quint64 key = s->key | pid;
+    ParamEntry *p = params.find(key);
+    if(!p)
+    {
+        p = new ParamEntry(key, s, param);
+        params.insert(key, p);
+        s->params.append(p);
+    }
+    ParamConsumer *pc = p->findConsumer(cd);
+    if(!pc)
+    {
+        pc = new ParamConsumer(cd, id);
+        p->consumers.append(pc);
+    }
+    return pc;
+}
+
+void SubscriptionIndex::delConsumer(ConnectionData *cd, QString cls, QString sec, QString param)
+{
+    SecurityEntry *s = findSecurity(cls, sec);
+    ParamEntry *p = findParam(cls, sec, param);
+    if(!s || !p)
+        return;
+    ParamConsumer *pc = p->findConsumer(cd);
+    if(pc)
+    {
+        p->consumers.removeOne(pc);
+        retire(pc);
+    }
+    if(p->consumers.isEmpty())
+        removeParam(s, p);
+    removeSecurityIfEmpty(s);
+}
+
+QuoteConsumer *SubscriptionIndex::addQuotesConsumer(ConnectionData *cd, QString cls, QString sec, int id)
+{
+    SecurityEntry *s = internSecurity(cls, sec);
+    if(!s)
+        return nullptr;
+    QuoteConsumer *qc = s->findQuoteConsumer(cd);
+    if(!qc)
+    {
+        qc = new QuoteConsumer(cd, id);
+        s->quoteConsumers.append(qc);
+    }
+    return qc;
+}
+
+void SubscriptionIndex::delQuotesConsumer(ConnectionData *cd, QString cls, QString sec)
+{
+    SecurityEntry *s = findSecurity(cls, sec);
+    if(!s)
+        return;
+    QuoteConsumer *qc = s->findQuoteConsumer(cd);
+    if(qc)
+    {
+        s->quoteConsumers.removeOne(qc);
+        retire(qc);
+    }
+    removeSecurityIfEmpty(s);
+}
+
+void SubscriptionIndex::clearAllSubscriptions(ConnectionData *cd)
+{
+    QList<SecurityEntry *> secs = securities.values();
+    foreach (SecurityEntry *s, secs)
+    {
+        QList<ParamEntry *> plist = s->params;
+        foreach (ParamEntry *p, plist)
+        {
+            ParamConsumer *pc = p->findConsumer(cd);
+            if(!pc)
+                continue;
+            p->consumers.removeOne(pc);
+            retire(pc);
+            if(p->consumers.isEmpty())
+                removeParam(s, p);
+        }
+        QuoteConsumer *qc = s->findQuoteConsumer(cd);
+        if(qc)
+        {
+            s->quoteConsumers.removeOne(qc);
+            retire(qc);
+        }
+        removeSecurityIfEmpty(s);
+    }
+}
+
+void SubscriptionIndex::collectSecurities(QList<SecurityKey> &paramSecs, QList<SecurityKey> &quoteSecs) const
+{
+    QList<SecurityEntry *> secs = securities.values();
+    foreach (SecurityEntry *s, secs)
+    {
+        if(!s->params.isEmpty())
+            paramSecs.append(SecurityKey(s->cls, s->sec));
+        if(!s->quoteConsumers.isEmpty())
+            quoteSecs.append(SecurityKey(s->cls, s->sec));
+    }
+}
+
+void SubscriptionIndex::endRead()
+{
+    if(readers > 0)
+        readers--;
+    if(!readers)
+        reclaim();
+}
+
+void SubscriptionIndex::removeParam(SecurityEntry *s, ParamEntry *p)
+{
+    params.take(p->key);
+    s->params.removeOne(p);
+    p->removed = true;
+    retiredParams.append(p);
+    if(!readers)
+        reclaim();
+}
+
+void SubscriptionIndex::removeSecurityIfEmpty(SecurityEntry *s)
+{
+    if(!s->isEmpty())
+        return;
+    securities.take(s->key);
+    s->removed = true;
+    retiredSecurities.append(s);
+    if(!readers)
+        reclaim();
+}
+
+void SubscriptionIndex::retire(ParamConsumer *c)
+{
+    c->removed = true;
+    retiredParamConsumers.append(c);
+    if(!readers)
+        reclaim();
+}
+
+void SubscriptionIndex::retire(QuoteConsumer *c)
+{
+    c->removed = true;
+    retiredQuoteConsumers.append(c);
+    if(!readers)
+        reclaim();
+}
+
+void SubscriptionIndex::reclaim()
+{
+    qDeleteAll(retiredQuoteConsumers);
+    retiredQuoteConsumers.clear();
+    qDeleteAll(retiredParamConsumers);
+    retiredParamConsumers.clear();
+    qDeleteAll(retiredParams);
+    retiredParams.clear();
+    qDeleteAll(retiredSecurities);
+    retiredSecurities.clear();
+}
@@ -0,0 +1,274 @@
+#ifndef SUBSCRIPTIONINDEX_H
+#define SUBSCRIPTIONINDEX_H
+
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+#include <QVector>
+#include <QHash>
+#include <QList>
+#include "securityinterestset.h"
+#include "quotebook.h"
+
+struct ConnectionData;
+
+//Интернирование имён (классов, бумаг, параметров) в целые номера.
+//Номер 0 зарезервирован под "нет такого имени", а старший номер (все единицы в разрядах) не выдаётся:
+//ключ из трёх таких номеров совпал бы с ключом удалённой записи FlatHashIndex.
+class SymbolTable
+{
+public:
+    SymbolTable(int idBits);
+    quint32 intern(const QString &name);
+    quint32 find(const QString &name) const;
+    QString name(quint32 id) const;
+    int count() const {return names.count() - 1;}
+private:
+    quint32 maxId;
+    QHash<QString, quint32> ids;
+    QVector<QString> names;
+};
+
+//Хеш-таблица с открытой адресацией (линейное пробирование) по упакованному ключу.
+//Ключи 0 и ~0 зарезервированы под пустую ячейку и удалённую запись.
+template <typename T>
+class FlatHashIndex
+{
+public:
+    FlatHashIndex() : used(0), filled(0) {table.resize(16);}
+    T *find(quint64 key) const
+    {
+        int mask = table.count() - 1;
+        int i = (int)(mix(key) & mask);
+        while(true)
+        {
+            const Slot &s = table.at(i);
+            if(s.key == key)
+                return s.value;
+            if(s.key == EmptyKey)
+                return nullptr;
+            i = (i + 1) & mask;
+        }
+    }
+    void insert(quint64 key, T *value)
+    {
+        if((filled + 1) * 4 > table.count() * 3)
+            rehash((used + 1) * 2 > table.count() / 2 ? table.count() * 2 : table.count());
+        int mask = table.count() - 1;
+        int i = (int)(mix(key) & mask);
+        int tomb = -1;
+        while(true)
+        {
+            Slot &s = table[i];
+            if(s.key == key)
+            {
+                s.value = value;
+                return;
+            }
+            if(s.key == EmptyKey)
+                break;
+            if(s.key == TombKey && tomb < 0)
+                tomb = i;
+            i = (i + 1) & mask;
+        }
+        if(tomb >= 0)
+            i = tomb;
+        else
+            filled++;
+        table[i].key = key;
+        table[i].value = value;
+        used++;
+    }
+    T *take(quint64 key)
+    {
+        int mask = table.count() - 1;
+        int i = (int)(mix(key) & mask);
+        while(true)
+        {
+            Slot &s = table[i];
+            if(s.key == key)
+            {
+                T *res = s.value;
+                s.key = TombKey;
+                s.value = nullptr;
+                used--;
+                return res;
+            }
+            if(s.key == EmptyKey)
+                return nullptr;
+            i = (i + 1) & mask;
+        }
+    }
+    int count() const {return used;}
+    QList<T *> values() const
+    {
+        QList<T *> res;
+        int i;
+        for(i=0; i<table.count(); i++)
+        {
+            if(table.at(i).key != EmptyKey && table.at(i).key != TombKey)
+                res.append(table.at(i).value);
+        }
+        return res;
+    }
+private:
+    static const quint64 EmptyKey = 0;
+    static const quint64 TombKey = Q_UINT64_C(0xFFFFFFFFFFFFFFFF);
+    struct Slot
+    {
+        quint64 key;
+        T *value;
+        Slot() : key(EmptyKey), value(nullptr){}
+    };
+    QVector<Slot> table;
+    int used;
+    int filled;
+    static quint64 mix(quint64 k)
+    {
+        k ^= k >> 33;
+        k *= Q_UINT64_C(0xff51afd7ed558ccd);
+        k ^= k >> 33;
+        k *= Q_UINT64_C(0xc4ceb9fe1a85ec53);
+        k ^= k >> 33;
+        return k;
+    }
+    void rehash(int capacity)
+    {
+        QVector<Slot> old;
+        old.swap(table);
+        table.resize(capacity);
+        used = 0;
+        filled = 0;
+        int i;
+        for(i=0; i<old.count(); i++)
+        {
+            if(old.at(i).key != EmptyKey && old.at(i).key != TombKey)
+                insert(old.at(i).key, old.at(i).value);
+        }
+    }
+};
+
+struct ParamConsumer
+{
+    ConnectionData *cd;
+    int id;
+    bool removed;
+    //ограничение частоты: не чаще одного paramChange за minIntervalMs,
+    //промежуточные значения схлопываются в последнее (pendingValue)
+    int minIntervalMs;
+    qint64 lastSentMs;
+    bool pending;
+    QVariant pendingValue;
+    //зона нечувствительности: изменение отправляется, только если значение ушло от
+    //последнего отправленного этому потребителю не меньше чем на deadband (абсолютно)
+    //или deadbandRel (доля от последнего отправленного значения)
+    double deadband;
+    double deadbandRel;
+    QVariant lastSentValue;
+    //групповой режим: все изменившиеся за проход параметры бумаги уходят одним paramsChange
+    bool grouped;
+    ParamConsumer(ConnectionData *c, int sid)
+        : cd(c), id(sid), removed(false), minIntervalMs(0), lastSentMs(0), pending(false),
+          deadband(0), deadbandRel(0), grouped(false){}
+    bool passesDeadband(const QVariant &value) const;
+};
+
+struct QuoteConsumer
+{
+    ConnectionData *cd;
+    int id;
+    bool removed;
+    //режим delta: quotesDelta относительно предыдущего стакана, полный quotesSnapshot
+    //первым сообщением, каждые snapshotEvery обновлений (0 - никогда) и по запросу
+    bool delta;
+    int snapshotEvery;
+    int sinceSnapshot;
+    bool needSnapshot;
+    //ограничение глубины: depth лучших уровней с каждой стороны (0 - весь стакан);
+    //lastBook - последний отправленный обрезанный стакан, по нему глушатся пустые обновления
+    int depth;
+    QuoteBook lastBook;
+    //числовой формат: уровни [цена * 10^scale, количество] целыми числами
+    bool numeric;
+    QuoteConsumer(ConnectionData *c, int sid)
+        : cd(c), id(sid), removed(false), delta(false), snapshotEvery(0), sinceSnapshot(0), needSnapshot(true), depth(0),
+          numeric(false){}
+};
+
+struct SecurityEntry;
+
+struct ParamEntry
+{
+    quint64 key;
+    SecurityEntry *security;
+    QString param;
+    QVariant value;
+    QList<ParamConsumer *> consumers;
+    bool removed;
+    ParamEntry(quint64 k, SecurityEntry *s, QString p) : key(k), security(s), param(p), removed(false){}
+    ParamConsumer *findConsumer(ConnectionData *cd) const;
+};
+
+struct SecurityEntry
+{
+    quint64 key;
+    QString cls;
+    QString sec;
+    QList<ParamEntry *> params;
+    QList<QuoteConsumer *> quoteConsumers;
+    QuoteBook book;
+    int scale;  //знаков после запятой в цене (getSecurityInfo), -1 - ещё не запрашивали
+    bool removed;
+    SecurityEntry(quint64 k, QString c, QString s) : key(k), cls(c), sec(s), scale(-1), removed(false){}
+    QuoteConsumer *findQuoteConsumer(ConnectionData *cd) const;
+    bool isEmpty() const {return params.isEmpty() && quoteConsumers.isEmpty();}
+};
+
+//Подписки на параметры и стаканы. Класс, бумага и параметр интернируются в номера,
+//записи лежат в плоской хеш-таблице по ключу cls<<40 | sec<<20 | param (param == 0 - строка бумаги).
+//Индекс живёт только в потоке сервера, поэтому блокировок нет. Проход рассылки оборачивается
+//в beginRead()/endRead() и работает по копиям списков (QList копируется при записи): удалённые
+//за время прохода записи и потребители помечаются removed и освобождаются после последнего endRead().
+class SubscriptionIndex
+{
+public:
+    SubscriptionIndex();
+    ~SubscriptionIndex();
+    ParamEntry *findParam(const QString &cls, const QString &sec, const QString &param) const;
+    SecurityEntry *findSecurity(const QString &cls, const QString &sec) const;
+    ParamEntry *paramByKey(quint64 key) const {return params.find(key);}
+    ParamConsumer *addConsumer(ConnectionData *cd, QString cls, QString sec, QString param, int id);
+    void delConsumer(ConnectionData *cd, QString cls, QString sec, QString param);
+    QuoteConsumer *addQuotesConsumer(ConnectionData *cd, QString cls, QString sec, int id);
+    void delQuotesConsumer(ConnectionData *cd, QString cls, QString sec);
+    void clearAllSubscriptions(ConnectionData *cd);
+    void collectSecurities(QList<SecurityKey> &paramSecs, QList<SecurityKey> &quoteSecs) const;
+    void beginRead() {readers++;}
+    void endRead();
+    int securitiesCount() const {return securities.count();}
+    int paramsCount() const {return params.count();}
+private:
+    SymbolTable classIds;
+    SymbolTable secIds;
+    SymbolTable paramIds;
+    FlatHashIndex<SecurityEntry> securities;
+    FlatHashIndex<ParamEntry> params;
+    int readers;
+    QList<SecurityEntry *> retiredSecurities;
+    QList<ParamEntry *> retiredParams;
+    QList<ParamConsumer *> retiredParamConsumers;
+    QList<QuoteConsumer *> retiredQuoteConsumers;
+    static quint64 makeKey(quint32 cls, quint32 sec, quint32 param)
+    {
+        return ((quint64)cls << 40) | ((quint64)sec << 20) | (quint64)param;
+    }
+    quint64 findKey(const QString &cls, const QString &sec, const QString &param) const;
+    SecurityEntry *internSecurity(const QString &cls, const QString &sec);
+    void removeParam(SecurityEntry *s, ParamEntry *p);
+    void removeSecurityIfEmpty(SecurityEntry *s);
+    void retire(ParamConsumer *c);
+    void retire(QuoteConsumer *c);
+    void reclaim();
+};
+
+#endif // SUBSCRIPTIONINDEX_H
@@ -0,0 +1,346 @@
+#include "tablemirror.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+static const TableMirrorSpec mirrorSpecs[] =
+{
+    {"orders", "OnOrder", nullptr, "order_num"},
+    {"trades", "OnTrade", nullptr, "trade_num"},
+    {"stop_orders", "OnStopOrder", nullptr, "order_num"},
+    {"futures_client_holding", "OnFuturesClientHolding", nullptr, "firmid,trdaccid,sec_code,type"},
+    {"depo_limits", "OnDepoLimit", "OnDepoLimitDelete", "firmid,client_code,sec_code,trdaccid,limit_kind"}
+};
+static const int mirrorSpecsCount = sizeof(mirrorSpecs) / sizeof(mirrorSpecs[0]);
+
+//поля, по которым ведётся хеш-индекс, если они есть в строках таблицы
+static const char *hashIndexFields[] = {"order_num", "trans_id", "sec_code", "account", "client_code"};
+static const int hashIndexFieldsCount = sizeof(hashIndexFields) / sizeof(hashIndexFields[0]);
+//поле упорядоченного индекса для выборок по диапазону
+static const char *timeIndexField = "datetime";
+
+TableMirror::TableMirror(const TableMirrorSpec &spec)
+    : tableName(spec.table),
+      cbName(spec.callback),
+      delCbName(spec.deleteCallback ? spec.deleteCallback : ""),
+      keyFields(QString(spec.keyFields).split(',')),
+      ver(0)
+{
+}
+
+const TableMirrorSpec *TableMirror::findSpec(const QString &table)
+{
+    int i;
+    for(i=0; i<mirrorSpecsCount; i++)
+    {
+        if(table == mirrorSpecs[i].table)
+            return &mirrorSpecs[i];
+    }
+    return nullptr;
+}
+
+const TableMirrorSpec *TableMirror::findSpecByCallback(const QString &callback)
+{
+    int i;
+    for(i=0; i<mirrorSpecsCount; i++)
+    {
+        if(callback == mirrorSpecs[i].callback || (mirrorSpecs[i].deleteCallback && callback == mirrorSpecs[i].deleteCallback))
+            return &mirrorSpecs[i];
+    }
+    return nullptr;
+}
+
+QStringList TableMirror::mirroredCallbacks()
+{
+    QStringList res;
+    int i;
+    for(i=0; i<mirrorSpecsCount; i++)
+    {
+        res.append(mirrorSpecs[i].callback);
+        if(mirrorSpecs[i].deleteCallback)
+            res.append(mirrorSpecs[i].deleteCallback);
+    }
+    return res;
+}
+
+int TableMirror::specIndex(const TableMirrorSpec *spec)
+{
+    if(spec < mirrorSpecs || spec >= mirrorSpecs + mirrorSpecsCount)
+        return -1;
+    return (int)(spec - mirrorSpecs);
+}
+
+static QVariant normalizeValue(const QVariant &v)
+{
+    switch((int)v.type())
+    {
+    case QVariant::Int:
+    case QVariant::UInt:
+    case QVariant::LongLong:
+    case QVariant::ULongLong:
+        return QVariant(v.toLongLong());
+    case QVariant::Double:
+    {
+        //луа отдаёт целые то как целые, то как double - в зависимости от пути разбора
+        double d = v.toDouble();
+        if(d == std::floor(d) && std::fabs(d) < 9.0e18)
+            return QVariant((qint64)d);
+        return v;
+    }
+    case QVariant::Map:
+        return TableMirror::normalizeRow(v.toMap());
+    default:
+        return v;
+    }
+}
+
+QVariantMap TableMirror::normalizeRow(const QVariantMap &row)
+{
+    QVariantMap res;
+    QVariantMap::const_iterator it;
+    for(it=row.constBegin(); it!=row.constEnd(); ++it)
+        res.insert(it.key(), normalizeValue(it.value()));
+    return res;
+}
+
+void TableMirror::seed(const QList<QVariantMap> &rows)
+{
+    store.clear();
+    live.clear();
+    byKey.clear();
+    hashIndexes.clear();
+    timeIndex.clear();
+    ver++;
+    int i, rowId;
+    for(i=0; i<rows.count(); i++)
+        apply(rows.at(i), false, rowId);
+}
+
+TableMirror::Change TableMirror::apply(const QVariantMap &srcRow, bool remove, int &rowId, QVariantMap *oldRow)
+{
+    QVariantMap row = normalizeRow(srcRow);
+    QString key = rowKey(row);
+    rowId = byKey.value(key, -1);
+    if(remove)
+    {
+        if(rowId < 0)
+            return NoChange;
+        byKey.remove(key);
+        live[rowId] = false;
+        unindexRow(rowId, store.at(rowId));
+        if(oldRow)
+            *oldRow = store.at(rowId);
+        //номер строки не переиспользуется, но её данные больше не нужны (чтение охраняет isLive)
+        store[rowId] = QVariantMap();
+        return Deleted;
+    }
+    if(rowId < 0)
+    {
+        rowId = store.count();
+        store.append(row);
+        live.append(true);
+        byKey.insert(key, rowId);
+        indexRow(rowId, row);
+        return Inserted;
+    }
+    //колбеки по одной записи приходят многократно, в том числе без изменений
+    if(store.at(rowId) == row)
+        return NoChange;
+    if(oldRow)
+        *oldRow = store.at(rowId);
+    reindexRow(rowId, store.at(rowId), row);
+    store[rowId] = row;
+    return Updated;
+}
+
+QList<int> TableMirror::liveRows() const
+{
+    QList<int> res;
+    int i;
+    for(i=0; i<live.count(); i++)
+    {
+        if(live.at(i))
+            res.append(i);
+    }
+    return res;
+}
+
+QString TableMirror::select(const RowFilter &flt, QList<int> &rowIds) const
+{
+    rowIds.clear();
+    //стоимость кандидата - сколько строк он даст; побеждает самый узкий индекс
+    int bestCost = byKey.count();
+    QString bestField;
+    QStringList bestValues;
+    foreach (const RowPredicate &p, flt.conditions())
+    {
+        if(p.op != RowPredicate::Eq && p.op != RowPredicate::In)
+            continue;
+        QHash<QString, QHash<QString, QVector<int> > >::const_iterator idx = hashIndexes.constFind(p.key);
+        if(idx == hashIndexes.constEnd())
+            continue;
+        QStringList values = p.fixedValues();
+        //повтор значения в in не должен давать одну корзину дважды
+        values.removeDuplicates();
+        int cost = 0;
+        foreach (QString v, values)
+        {
+            QHash<QString, QVector<int> >::const_iterator bucket = idx.value().constFind(v);
+            if(bucket != idx.value().constEnd())
+                cost += bucket.value().count();
+        }
+        if(cost < bestCost || bestField.isEmpty())
+        {
+            bestCost = cost;
+            bestField = p.key;
+            bestValues = values;
+        }
+    }
+    //диапазон по времени считается только до лучшей найденной стоимости
+    int rangeCost = rangeCandidates(flt, bestCost, nullptr);
+    if(rangeCost >= 0 && (rangeCost < bestCost || bestField.isEmpty()))
+    {
+        rangeCandidates(flt, INT_MAX, &rowIds);
+        return QString(timeIndexField);
+    }
+    if(bestField.isEmpty())
+    {
+        rowIds = liveRows();
+        return QString();
+    }
+    const QHash<QString, QVector<int> > &idx = hashIndexes[bestField];
+    QVector<int> ids;
+    ids.reserve(bestCost);
+    foreach (QString v, bestValues)
+        ids += idx.value(v);
+    if(bestValues.count() > 1)
+        std::sort(ids.begin(), ids.end());
+    rowIds.reserve(ids.count());
+    foreach (int rowId, ids)
+        rowIds.append(rowId);
+    return bestField;
+}
+
+//Строки, попадающие в границы условий на datetime, не больше maxCount.
+//Возвращает их число или -1, если границ по времени в фильтре нет
+int TableMirror::rangeCandidates(const RowFilter &flt, int maxCount, QList<int> *rowIds) const
+{
+    bool hasLo = false, hasHi = false, loIncl = true, hiIncl = true;
+    double lo = 0, hi = 0;
+    foreach (const RowPredicate &p, flt.conditions())
+    {
+        if(p.key != timeIndexField || !p.isNumeric)
+            continue;
+        double v = p.numValue;
+        if(p.op == RowPredicate::Gt || p.op == RowPredicate::Ge || p.op == RowPredicate::Eq)
+        {
+            bool incl = (p.op != RowPredicate::Gt);
+            if(!hasLo || v > lo || (v == lo && !incl))
+            {
+                lo = v;
+                loIncl = incl;
+            }
+            hasLo = true;
+        }
+        if(p.op == RowPredicate::Lt || p.op == RowPredicate::Le || p.op == RowPredicate::Eq)
+        {
+            bool incl = (p.op != RowPredicate::Lt);
+            if(!hasHi || v < hi || (v == hi && !incl))
+            {
+                hi = v;
+                hiIncl = incl;
+            }
+            hasHi = true;
+        }
+    }
+    if(!hasLo && !hasHi)
+        return -1;
+    QMultiMap<double, int>::const_iterator it = timeIndex.constBegin();
+    if(hasLo)
+        it = loIncl ? timeIndex.lowerBound(lo) : timeIndex.upperBound(lo);
+    int n = 0;
+    while(it != timeIndex.constEnd() && n < maxCount)
+    {
+        if(hasHi && (it.key() > hi || (it.key() == hi && !hiIncl)))
+            break;
+        if(rowIds)
+            rowIds->append(it.value());
+        n++;
+        ++it;
+    }
+    if(rowIds)
+        std::sort(rowIds->begin(), rowIds->end());
+    return n;
+}
+
+void TableMirror::indexRow(int rowId, const QVariantMap &row)
+{
+    int i;
+    for(i=0; i<hashIndexFieldsCount; i++)
+    {
+        QVariantMap::const_iterator it = row.constFind(hashIndexFields[i]);
+        if(it == row.constEnd())
+            continue;
+        QVector<int> &bucket = hashIndexes[hashIndexFields[i]][RowFilter::indexValue(it.value())];
+        bucket.insert(std::lower_bound(bucket.begin(), bucket.end(), rowId), rowId);
+    }
+    double t;
+    QVariantMap::const_iterator dt = row.constFind(timeIndexField);
+    if(dt != row.constEnd() && RowFilter::numberValue(dt.value(), t))
+        timeIndex.insert(t, rowId);
+}
+
+void TableMirror::unindexRow(int rowId, const QVariantMap &row)
+{
+    int i;
+    for(i=0; i<hashIndexFieldsCount; i++)
+    {
+        QVariantMap::const_iterator it = row.constFind(hashIndexFields[i]);
+        if(it == row.constEnd())
+            continue;
+        QHash<QString, QVector<int> > &idx = hashIndexes[hashIndexFields[i]];
+        QString value = RowFilter::indexValue(it.value());
+        QHash<QString, QVector<int> >::iterator bucket = idx.find(value);
+        if(bucket == idx.end())
+            continue;
+        QVector<int>::iterator pos = std::lower_bound(bucket.value().begin(), bucket.value().end(), rowId);
+        if(pos != bucket.value().end() && *pos == rowId)
+            bucket.value().erase(pos);
+        if(bucket.value().isEmpty())
+            idx.erase(bucket);
+    }
+    double t;
+    QVariantMap::const_iterator dt = row.constFind(timeIndexField);
+    if(dt != row.constEnd() && RowFilter::numberValue(dt.value(), t))
+        timeIndex.remove(t, rowId);
+}
+
+void TableMirror::reindexRow(int rowId, const QVariantMap &oldRow, const QVariantMap &newRow)
+{
+    //индексы трогаются, только если изменились индексируемые поля: обычно меняются
+    //остаток и статус заявки, а не её номер, бумага или время
+    bool changed = (oldRow.value(timeIndexField) != newRow.value(timeIndexField));
+    int i;
+    for(i=0; i<hashIndexFieldsCount && !changed; i++)
+    {
+        if(oldRow.value(hashIndexFields[i]) != newRow.value(hashIndexFields[i]))
+            changed = true;
+    }
+    if(!changed)
+        return;
+    unindexRow(rowId, oldRow);
+    indexRow(rowId, newRow);
+}
+
+QString TableMirror::rowKey(const QVariantMap &row) const
+{
+    QString key;
+    int i;
+    for(i=0; i<keyFields.count(); i++)
+    {
+        if(i)
+            key.append(QChar('|'));
+        key.append(row.value(keyFields.at(i)).toString());
+    }
+    return key;
+}
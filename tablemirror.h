@@ -0,0 +1,83 @@
+#ifndef TABLEMIRROR_H
+#define TABLEMIRROR_H
+
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+#include <QVector>
+#include <QList>
+#include <QHash>
+#include <QMap>
+#include "rowfilter.h"
+
+//Какая таблица квика зеркалируется, каким колбеком она обновляется
+//и по каким полям строки узнаётся одна и та же запись
+struct TableMirrorSpec
+{
+    const char *table;
+    const char *callback;
+    const char *deleteCallback;
+    const char *keyFields;
+};
+
+//Зеркало таблицы квика в памяти сервера: заполняется один раз через getItem,
+//дальше обновляется строками из колбеков. Строки хранятся по номерам, номер строки
+//не меняется, пока зеркало не перезаполнено (удалённые остаются пустыми ячейками).
+//По живым строкам ведутся вторичные индексы: хеш по полям с фиксированным значением
+//(order_num, trans_id, sec_code, account, client_code) и упорядоченный по datetime.
+//Числовые значения строк приводятся к одному виду (целые - qint64, дробные - double), чтобы
+//строки из getItem и из колбеков сравнивались и индексировались одинаково.
+//Живёт только в потоке сервера.
+class TableMirror
+{
+public:
+    enum Change
+    {
+        NoChange,
+        Inserted,
+        Updated,
+        Deleted
+    };
+    TableMirror(const TableMirrorSpec &spec);
+    static const TableMirrorSpec *findSpec(const QString &table);
+    static const TableMirrorSpec *findSpecByCallback(const QString &callback);
+    static QStringList mirroredCallbacks();
+    //номер описания в списке зеркалируемых таблиц (меньше 32), -1 - не из списка
+    static int specIndex(const TableMirrorSpec *spec);
+    static QVariantMap normalizeRow(const QVariantMap &row);
+    QString table() const {return tableName;}
+    QString callback() const {return cbName;}
+    QString deleteCallback() const {return delCbName;}
+    //version меняется только при перезаполнении: номера строк в курсорах выборок по нему сверяются
+    quint64 version() const {return ver;}
+    void seed(const QList<QVariantMap> &rows);
+    //при удалении строка очищается, её прежнее содержимое отдаётся в oldRow
+    Change apply(const QVariantMap &srcRow, bool remove, int &rowId, QVariantMap *oldRow = nullptr);
+    const QVariantMap &row(int rowId) const {return store.at(rowId);}
+    bool isLive(int rowId) const {return rowId >= 0 && rowId < live.count() && live.at(rowId);}
+    int slotsCount() const {return store.count();}
+    int count() const {return byKey.count();}
+    QList<int> liveRows() const;
+    //кандидаты под фильтр по самому узкому индексу (или все живые строки), номера по возрастанию;
+    //возвращает имя использованного индекса или пустую строку
+    QString select(const RowFilter &flt, QList<int> &rowIds) const;
+private:
+    QString tableName;
+    QString cbName;
+    QString delCbName;
+    QStringList keyFields;
+    QVector<QVariantMap> store;
+    QVector<bool> live;
+    QHash<QString, int> byKey;
+    quint64 ver;
+    //поле -> нормализованное значение -> номера строк по возрастанию
+    QHash<QString, QHash<QString, QVector<int> > > hashIndexes;
+    QMultiMap<double, int> timeIndex;
+    QString rowKey(const QVariantMap &row) const;
+    void indexRow(int rowId, const QVariantMap &row);
+    void unindexRow(int rowId, const QVariantMap &row);
+    void reindexRow(int rowId, const QVariantMap &oldRow, const QVariantMap &newRow);
+    int rangeCandidates(const RowFilter &flt, int maxCount, QList<int> *rowIds) const;
+};
+
+#endif // TABLEMIRROR_H
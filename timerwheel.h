@@ -0,0 +1,80 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <QVector>
+#include <QList>
+
+//Хешированное колесо таймеров: элемент попадает в ячейку по времени срабатывания,
+//advance() проходит только ячейки тиков, прошедших с прошлого вызова.
+//Элементы со сроком дальше одного оборота остаются в ячейке до своего срока.
+template <typename T>
+class TimerWheel
+{
+public:
+    TimerWheel(int slotCount, int tickMs)
+        : tick(tickMs), lastTick(-1), started(false), count(0)
+    {
+        wheel.resize(slotCount);
+    }
+    int tickMs() const {return tick;}
+    bool isEmpty() const {return count == 0;}
+    void schedule(const T &item, qint64 dueMs)
+    {
+        Entry e;
+        e.item = item;
+        e.due = dueMs;
+        qint64 t = dueMs / tick;
+        //до первого advance() отсчёт начинается с самого раннего срока, иначе его ячейку пропустят до конца оборота
+        if(!started && (lastTick < 0 || t <= lastTick))
+            lastTick = t - 1;
+        else if(t <= lastTick)
+            t = lastTick + 1;
+        //ячейку элемента advance() обязательно пройдёт: она не раньше следующего непройденного тика
+        Q_ASSERT(t > lastTick);
+        wheel[(int)(t % wheel.count())].append(e);
+        count++;
+    }
+    QList<T> advance(qint64 nowMs)
+    {
+        QList<T> res;
+        qint64 nowTick = nowMs / tick;
+        if(!started && count == 0)
+            lastTick = nowTick - 1;
+        started = true;
+        qint64 from = lastTick + 1;
+        if(nowTick - from >= wheel.count())
+            from = nowTick - wheel.count() + 1;
+        qint64 t;
+        for(t=from; t<=nowTick; t++)
+        {
+            QList<Entry> &slot = wheel[(int)(t % wheel.count())];
+            int i = 0;
+            while(i < slot.count())
+            {
+                if(slot.at(i).due <= nowMs)
+                {
+                    res.append(slot.takeAt(i).item);
+                    count--;
+                }
+                else
+                    i++;
+            }
+        }
+        if(nowTick > lastTick)
+            lastTick = nowTick;
+        return res;
+    }
+private:
+    struct Entry
+    {
+        T item;
+        qint64 due;
+    };
+    QVector<QList<Entry> > wheel;
+    int tick;
+    qint64 lastTick;
+    bool started;
+    int count;
+};
+
+#endif // TIMERWHEEL_H